@@ -17,6 +17,8 @@
 #pragma once
 #include "config.h"
 
+#include "configurable_state_manager_builtin.hpp"
+#include "configurable_state_manager_rules.hpp"
 #include "utils.hpp"
 #include "xyz/openbmc_project/State/Chassis/server.hpp"
 #include "xyz/openbmc_project/State/DeviceReady/server.hpp"
@@ -24,25 +26,35 @@
 #include "xyz/openbmc_project/State/InterfaceReady/server.hpp"
 #include "xyz/openbmc_project/State/ServiceReady/server.hpp"
 
+#include <gpiod.h>
+#include <sys/inotify.h>
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/format.hpp>
 #include <nlohmann/json.hpp>
 #include <phosphor-logging/log.hpp>
+#include <sdbusplus/asio/connection.hpp>
 #include <sdbusplus/asio/object_server.hpp>
 #include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
 #include <sdbusplus/server/manager.hpp>
 
+#include <array>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
 using namespace phosphor::logging;
 using Json = nlohmann::ordered_json;
 
-// in case of local dependency for get/set on property use this cache
-// to be used because get/set on same service gives deadlock
-//  local cache containg objectPath, propertyName combination
-static std::unordered_map<std::string, std::string> localCache = {
-    {"/xyz/openbmc_project/state/configurableStateManager/ChassisPower",
-     "Unknown"}};
-
 namespace configurable_state_manager
 {
 using FeatureIntfInherit = sdbusplus::server::object::object<
@@ -56,45 +68,265 @@ using ServiceIntfInherit = sdbusplus::server::object::object<
 using ChassisIntfInherit = sdbusplus::server::object::object<
     sdbusplus::xyz::openbmc_project::State::server::Chassis>;
 
-// Define a visitor to convert the variant to a string
-struct VariantToStringVisitor
+static_assert(
+    std::is_same_v<PropertyValue,
+                   phosphor::state::manager::utils::PropertyValue>,
+    "rule values must be read from dbus as utils::PropertyValue");
+
+class StateMachineHandler;
+
+// reply of the mapper GetSubTree, services and interfaces by object path
+using SubTree =
+    std::map<std::string, std::map<std::string, std::vector<std::string>>>;
+
+// csm specific status of each state machine object
+constexpr auto statusInterface = "com.nvidia.ConfigurableStateManager.Status";
+// evaluation metrics of each state machine object
+constexpr auto metricsInterface = "com.nvidia.ConfigurableStateManager.Metrics";
+// states of all the state machines at once, on the csm root object
+constexpr auto summaryInterface = "com.nvidia.ConfigurableStateManager.Summary";
+
+// monitored systemd units are listed by unit name under this interface and
+// read from systemd directly, systemd is not known to the mapper
+constexpr auto systemdService = "org.freedesktop.systemd1";
+constexpr auto systemdObjPath = "/org/freedesktop/systemd1";
+constexpr auto systemdManagerInterface = "org.freedesktop.systemd1.Manager";
+constexpr auto systemdUnitInterface = "org.freedesktop.systemd1.Unit";
+
+// GPIO lines listed by line name and files, e.g. sysfs attributes, listed by
+// path under these interfaces are read by csm itself, their "Value" is the
+// line level or the content of the file
+constexpr auto gpioInterface = "com.nvidia.ConfigurableStateManager.Gpio";
+constexpr auto fileInterface = "com.nvidia.ConfigurableStateManager.File";
+
+/** @class SignalDemux
+ *  @brief Namespace wide signal subscriptions shared by all state machines
+ *
+ *  Instead of match rules per monitored object, one PropertiesChanged rule
+ *  is registered per namespace of the monitored object paths (their first
+ *  namespaceDepth components) and one InterfacesAdded rule for the whole
+ *  bus. Signals are handed to the subscribed state machines through a hash
+ *  lookup on the object path.
+ *
+ *  The values of a monitored object are dropped from the state machines
+ *  when it loses the interface (InterfacesRemoved) or when the service it
+ *  was read from or which signalled it leaves the bus (NameOwnerChanged),
+ *  they are fetched again on the next evaluation.
+ *
+ *  Once a systemd unit is monitored, csm subscribes to systemd so that it
+ *  emits PropertiesChanged for its units, and the units whose job finished
+ *  (JobRemoved) are read again.
+ */
+class SignalDemux
 {
-    std::string operator()(int value) const
-    {
-        return std::to_string(value);
-    }
+  public:
+    static SignalDemux& instance();
 
-    std::string operator()(double value) const
-    {
-        return std::to_string(value);
-    }
+    /** @brief Set the connection the rules are added to, must be called
+     *         before the first subscribe() */
+    void attach(sdbusplus::asio::connection& conn);
+
+    /** @brief Deliver the signals for interface on objectPath to handler */
+    void subscribe(const std::string& objectPath, const std::string& intf,
+                   StateMachineHandler* handler);
+
+    /** @brief Hand the objects matching pattern which get or lose
+     *         interface to handler */
+    void subscribePattern(const std::string& pattern, const std::string& intf,
+                          StateMachineHandler* handler);
+
+    /** @brief Stop delivering signals to handler */
+    void unsubscribe(StateMachineHandler* handler);
+
+    /** @brief Stop delivering the signals for interface on objectPath to
+     *         handler */
+    void unsubscribe(const std::string& objectPath, const std::string& intf,
+                     StateMachineHandler* handler);
 
-    std::string operator()(const std::string& value) const
+    /** @brief Record that owner, a unique or well known bus name, serves
+     *         interface on objectPath */
+    void addOwner(const std::string& owner, const std::string& objectPath,
+                  const std::string& intf);
+
+  private:
+    // components of the object paths a PropertiesChanged rule covers
+    static constexpr size_t namespaceDepth = 3;
+
+    struct Subscriber
     {
-        return value;
-    }
+        std::string intf;
+        StateMachineHandler* handler;
+    };
 
-    std::string operator()(bool value) const
+    struct PatternSubscriber
     {
-        return value ? "true" : "false";
-    }
+        std::string pattern;
+        std::string intf;
+        StateMachineHandler* handler;
+    };
+
+    SignalDemux() = default;
+    void addNamespace(const std::string& objectPath);
+    void propertiesChanged(sdbusplus::message::message& msg);
+    void interfacesAdded(sdbusplus::message::message& msg);
+    void interfacesRemoved(sdbusplus::message::message& msg);
+    void nameOwnerChanged(sdbusplus::message::message& msg);
+    /** @brief Hand over to the subscribers that interface is gone from
+     *         objectPath */
+    void objectRemoved(const std::string& objectPath, const std::string& intf);
+    /** @brief Subscribe to systemd and watch JobRemoved, for the first
+     *         monitored unit */
+    void watchSystemdUnits();
+    void subscribeToSystemd();
+    void jobRemoved(sdbusplus::message::message& msg);
+
+    sdbusplus::asio::connection* conn = nullptr;
+    std::unordered_map<std::string, std::vector<Subscriber>> subscribers;
+    std::vector<PatternSubscriber> patternSubscribers;
+    // PropertiesChanged rule per namespace
+    std::map<std::string, std::unique_ptr<sdbusplus::bus::match_t>,
+             std::less<>>
+        namespaceMatches;
+    std::unique_ptr<sdbusplus::bus::match_t> interfacesAddedMatch;
+    std::unique_ptr<sdbusplus::bus::match_t> interfacesRemovedMatch;
+    std::unique_ptr<sdbusplus::bus::match_t> ownerMatch;
+    // monitored (object path, interface) by the bus name serving them
+    std::unordered_map<std::string,
+                       std::set<std::pair<std::string, std::string>>>
+        objectsByOwner;
+    std::unique_ptr<sdbusplus::bus::match_t> jobRemovedMatch;
+    // systemd forgets its subscribers when it restarts
+    std::unique_ptr<sdbusplus::bus::match_t> systemdOwnerMatch;
 };
 
-// Define a structure for conditions
-struct Condition
+/** @class StateRegistry
+ *  @brief Properties of the objects hosted by csm itself
+ *
+ *  Every category publishes the properties it sets here. A state machine
+ *  depending on another csm state reads it from the registry and is handed
+ *  its changes directly, without going through dbus. The dependents of a
+ *  change are evaluated as one wave in dependency order, in the same loop
+ *  iteration, each of them at most once.
+ */
+class StateRegistry
 {
-    std::string intf;
-    std::string property;
-    std::string value;
-    std::string logic;
+  public:
+    static StateRegistry& instance();
+
+    /** @brief Store a property of an object hosted by csm and, if it
+     *         changed, evaluate the state machines depending on it */
+    void publish(const std::string& objectPath, const std::string& intf,
+                 const std::string& property, const std::string& value);
+
+    /** @brief Drop the properties of an object which goes away, the state
+     *         machines depending on it are evaluated without them */
+    void remove(const std::string& objectPath);
+
+    /** @brief Keep the changes from the dependents until release(), while
+     *         state machines are replaced */
+    void hold();
+
+    /** @brief Hand the properties changed since hold() to their dependents
+     *         as one wave. Each is compared with its value before hold(),
+     *         one set back to it changes nothing. */
+    void release();
+
+    /** @brief Whether the object is hosted by csm */
+    bool hosts(const std::string& objectPath) const;
+
+    std::optional<PropertyValue> find(const std::string& objectPath,
+                                      const std::string& intf,
+                                      const std::string& property) const;
+
+    /** @brief Hand the changes of objectPath to handler */
+    void subscribe(const std::string& objectPath, StateMachineHandler* handler);
+
+    void unsubscribe(StateMachineHandler* handler);
+
+  private:
+    StateRegistry() = default;
+    void propagate();
+    /** @brief Add the dependents of a property which changed to the wave */
+    void addDependents(const std::string& objectPath, const std::string& intf,
+                       const std::string& property);
+
+    // properties of each hosted object by (interface, property)
+    std::unordered_map<
+        std::string,
+        std::map<std::pair<std::string, std::string>, PropertyValue>>
+        objects;
+    std::unordered_map<std::string, std::vector<StateMachineHandler*>>
+        subscribers;
+    // dependents still to evaluate in the current wave, by rank
+    std::set<std::pair<size_t, StateMachineHandler*>> wave;
+    bool propagating = false;
+    bool held = false;
+    // values before hold() of the properties changed since, std::nullopt
+    // for the ones which were not set
+    std::map<std::tuple<std::string, std::string, std::string>,
+             std::optional<PropertyValue>>
+        heldChanges;
 };
 
-// Define a structure for states
-struct State
+/** @class LocalSources
+ *  @brief GPIO lines and files the conditions look at, without dbus
+ *
+ *  Every source is watched through one long lived file descriptor in the
+ *  asio loop: the edge events of a GPIO line, POLLPRI of a sysfs attribute
+ *  or inotify on the directory of any other file. A change of its "Value"
+ *  is handed to the subscribed state machines as a PropertiesChanged.
+ */
+class LocalSources
 {
-    std::string name;
-    std::vector<Condition> conditions;
-    std::string logic;
+  public:
+    static LocalSources& instance();
+
+    /** @brief Set the io context the sources are watched in, must be called
+     *         before the first subscribe() */
+    void attach(boost::asio::io_context& io);
+
+    /** @brief Whether the monitored objects of intf are local sources */
+    static bool isLocal(std::string_view intf);
+
+    /** @brief Watch source, a line name or a file path, and hand the changes
+     *         of its value to handler */
+    void subscribe(const std::string& intf, const std::string& source,
+                   StateMachineHandler* handler);
+
+    void unsubscribe(StateMachineHandler* handler);
+
+    /** @brief Last value of source, std::nullopt if it could not be read */
+    std::optional<PropertyValue> find(const std::string& intf,
+                                      const std::string& source) const;
+
+  private:
+    struct Source
+    {
+        std::string intf;
+        std::string name;
+        std::optional<PropertyValue> value;
+        std::vector<StateMachineHandler*> handlers;
+        // edge event fd of the line, the sysfs attribute or inotify fd
+        std::unique_ptr<boost::asio::posix::stream_descriptor> descriptor;
+        gpiod_line* line = nullptr;
+        alignas(inotify_event) std::array<char, 1024> events;
+
+        ~Source();
+    };
+
+    LocalSources() = default;
+    void openGpio(Source& source);
+    void openSysfs(Source& source);
+    void openFile(Source& source);
+    void waitGpio(Source& source);
+    void waitSysfs(Source& source);
+    void waitFile(Source& source);
+    /** @brief Store a new value of source and hand it over if it changed */
+    void update(Source& source, std::optional<PropertyValue> value);
+
+    boost::asio::io_context* io = nullptr;
+    std::map<std::pair<std::string, std::string>, std::unique_ptr<Source>>
+        sources;
 };
 
 class StateMachineHandler
@@ -108,40 +340,251 @@ class StateMachineHandler
     std::string defaultState;
     std::string errorState;
     std::string objPathCreated;
-    std::vector<State> states;
+    // object paths of servicesToBeMonitored by interface, the explicit ones
+    // and those currently on dbus matching one of pathPatterns
+    std::unordered_map<std::string, std::vector<std::string>> monitoredObjects;
+    // object paths of servicesToBeMonitored with a '*' by interface
+    std::unordered_map<std::string, std::vector<std::string>> pathPatterns;
+    // compiled states bound to the monitored objects, also holds the last
+    // known value of every monitored (objectPath, interface, property)
+    // combination, seeded on first evaluation and then kept current from
+    // the payload of PropertiesChanged/InterfacesAdded signals
+    RuleProgram program;
+    // Shared asio connection all the evaluation traffic goes through
+    std::shared_ptr<sdbusplus::asio::connection> conn;
     // Constructor that takes the JSON configuration as input
     StateMachineHandler(
+        std::shared_ptr<sdbusplus::asio::connection> conn,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
         const std::string& errorState, const char* objPathCreated,
-        const std::vector<State>& states) :
+        std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
         interfaceName(interfaceName),
         featureType(featureType), servicesToBeMonitored(servicesToBeMonitored),
         stateProperty(stateProperty), defaultState(defaultState),
-        errorState(errorState), objPathCreated(objPathCreated), states(states)
-    {}
-    virtual ~StateMachineHandler() {}
+        errorState(errorState), objPathCreated(objPathCreated),
+        monitoredObjects(explicitObjects(servicesToBeMonitored)),
+        program(std::move(rules), monitoredObjects), conn(std::move(conn)),
+        debounce(debounce), debounceTimer(this->conn->get_io_context()),
+        retryTimers(program.slotCount()), fetching(program.slotCount()),
+        holdTimers(program.holdCount()),
+        holdGenerations(program.holdCount()), reportedState(defaultState),
+        reportedSince(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count()))
+    {
+        for (const auto& [intf, objectPaths] : servicesToBeMonitored)
+        {
+            for (const std::string& objectPath : objectPaths)
+            {
+                if (isPathPattern(objectPath))
+                {
+                    pathPatterns[intf].push_back(objectPath);
+                }
+            }
+        }
+    }
+    virtual ~StateMachineHandler()
+    {
+        SignalDemux::instance().unsubscribe(this);
+        StateRegistry::instance().unsubscribe(this);
+        LocalSources::instance().unsubscribe(this);
+        StateRegistry::instance().remove(objPathCreated);
+        if (statusIntf)
+        {
+            objectServer->remove_interface(statusIntf);
+        }
+        if (metricsIntf)
+        {
+            objectServer->remove_interface(metricsIntf);
+        }
+    }
 
-    std::vector<std::unique_ptr<sdbusplus::bus::match::match>>
-        eventHandlerMatcher;
+    // async replies hold a weak reference and are dropped once the state
+    // machine is destroyed, e.g. on reload of its json, or its program is
+    // rebuilt for a change of the monitored objects
+    std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+
+    // settle window batching the signals of a burst into one evaluation,
+    // zero evaluates on every signal
+    std::chrono::milliseconds debounce;
+    boost::asio::steady_timer debounceTimer;
+    bool debouncePending = false;
+
+    // Maximum number of attempts for a Get which timed out
+    static constexpr int maxFetchRetries = 4;
+    // a timed out Get is retried after retryBaseDelay * 2^attempt, capped at
+    // retryMaxDelay, less a random part of up to half of it
+    static constexpr std::chrono::milliseconds retryBaseDelay{200};
+    static constexpr std::chrono::milliseconds retryMaxDelay{5000};
+    // backoff timer per slot, the slot stays pending while it is armed
+    std::vector<std::unique_ptr<boost::asio::steady_timer>> retryTimers;
+    // slots whose Get is outstanding, retries included, only the states
+    // needing them wait for it
+    std::vector<bool> fetching;
+    // timer per hold of the program, armed while a condition or state with
+    // a "HoldTime" is true but has not held long enough yet
+    std::vector<std::unique_ptr<boost::asio::steady_timer>> holdTimers;
+    // bumped whenever a hold starts or stops, a timer completion of an
+    // older generation is ignored
+    std::vector<uint64_t> holdGenerations;
+
+    // when an evaluation fails the last good state is kept, flagged as
+    // stale, for up to stalenessBudget while revalidating every
+    // revalidateInterval, only then the default state is set and the
+    // state machine waits for signals as without a budget
+    static constexpr std::chrono::seconds revalidateInterval{2};
+    std::chrono::milliseconds stalenessBudget{0};
+    std::optional<std::string> lastGoodState;
+    bool stale = false;
+    boost::asio::steady_timer staleTimer{conn->get_io_context()};
+    boost::asio::steady_timer revalidateTimer{conn->get_io_context()};
+
+    // state of the previous run published at startup, until the first
+    // evaluation from live values replaces it
+    std::optional<std::string> provisionalState;
+    // called whenever lastGoodState changes, so that it gets persisted
+    std::function<void()> onStateChanged;
+
+    // statusInterface of the object, Stale/StaleSince/StalenessBudget
+    // and Provisional
+    std::shared_ptr<sdbusplus::asio::object_server> objectServer;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> statusIntf;
+    // metricsInterface of the object, its properties are read from metrics
+    // when asked for and never signalled
+    std::shared_ptr<sdbusplus::asio::dbus_interface> metricsIntf;
+    EvaluationMetrics metrics;
+    // when the trigger of the current round came in, the latency recorded
+    // once it reports its state
+    std::optional<std::chrono::steady_clock::time_point> roundStart;
+    std::chrono::steady_clock::time_point lastChange =
+        std::chrono::steady_clock::now();
+
+    // last transitions of the reported state, queried with
+    // GetTransitionHistory of statusInterface
+    static constexpr size_t historyCapacity = 64;
+    TransitionHistory history{historyCapacity};
+    // state currently reported and what last made the state machine
+    // evaluate, recorded with each transition
+    std::string reportedState;
+    // milliseconds since epoch reportedState was set
+    uint64_t reportedSince = 0;
+    std::string trigger = "Startup";
+    // set by the initial transition, changes of other csm states before it
+    // are only cached
+    bool started = false;
+    // position in the dependency order of the csm states, a state machine
+    // is only ever evaluated after the ones it depends on
+    size_t rank = 0;
 
     void executeTransition();
-    phosphor::state::manager::utils::PropertyValue handleTimeoutRetries(
-        sdbusplus::bus::bus& bus, const std::string& objectPath,
-        const std::string& interface, const std::string& property);
-    bool any(const std::vector<bool>& bool_vector);
-    bool all(const std::vector<bool>& bool_vector);
+    void scheduleTransition();
+    void evaluateStates();
+    /** @brief Arm and cancel holdTimers as the last evaluation asks */
+    void updateHoldTimers();
+    /** @brief Add statusInterface to the object of the state machine */
+    void registerStatus(
+        std::shared_ptr<sdbusplus::asio::object_server> objectServer,
+        std::chrono::milliseconds stalenessBudget);
+    /** @brief Add metricsInterface to the object of the state machine, after
+     *         registerStatus() */
+    void registerMetrics();
+    /** @brief Keep the last good state on a failed evaluation, until the
+     *         staleness budget runs out */
+    void markStale();
+    void markFresh();
+    /** @brief Publish a state known from before the state machine was
+     *         created as provisional, ignored when the rules have no such
+     *         state
+     *  @param[in] source - where the state comes from, its trigger in the
+     *                      history */
+    void restoreState(const std::string& state,
+                      const std::string& source = "PersistedState");
+    void clearProvisional();
+    void setLastGoodState(std::optional<std::string> state);
+    /** @brief Set the state property, recording the transition in history
+     *         when the state changes */
+    void reportState(const std::string& state);
+    void monitorServices();
+    /** @brief Monitor the objects of subtree matching pathPatterns */
+    void addPatternMatches(const SubTree& subtree);
+    /** @brief Resolve pathPatterns with a mapper GetSubTree, then call
+     *         callback */
+    void resolvePathPatterns(std::function<void()> callback);
+    /** @brief Start monitoring an object which matches pathPatterns
+     *  @param[in] properties - values of interface it came with */
+    void addMonitoredObject(
+        const std::string& objectPath, const std::string& interface,
+        const std::map<std::string,
+                       phosphor::state::manager::utils::PropertyValue>&
+            properties);
+    /** @brief Stop monitoring an object matching pathPatterns */
+    void removeMonitoredObject(const std::string& objectPath,
+                               const std::string& interface);
+    /** @return whether objectPath was not monitored for interface yet */
+    bool monitorObject(const std::string& objectPath,
+                       const std::string& interface);
+    /** @brief Bind the rules to monitoredObjects again, keeping the known
+     *         values */
+    void rebuildProgram();
+    void handlePropertiesChanged(
+        const std::string& objectPath, const std::string& interface,
+        const std::map<std::string,
+                       phosphor::state::manager::utils::PropertyValue>&
+            changedProperties,
+        const std::vector<std::string>& invalidatedProperties);
+    /** @return whether the state machine needs to be evaluated */
+    bool handleStateChanged(const std::string& objectPath,
+                            const std::string& interface,
+                            const std::string& property,
+                            const PropertyValue& value);
+    /** @brief An object monitored left the bus or lost interface, its
+     *         values are fetched again */
+    void handleInterfacesRemoved(const std::string& objectPath,
+                                 const std::string& interface);
+    /** @brief A csm object the state machine depends on went away
+     *  @return whether the state machine needs to be evaluated */
+    bool handleStateRemoved(const std::string& objectPath,
+                            const std::string& interface,
+                            const std::string& property);
+    /** @brief Set a property of the hosted object in the StateRegistry */
+    void publishState(const std::string& propertyName, const std::string& val)
+    {
+        StateRegistry::instance().publish(objPathCreated, interfaceName,
+                                          propertyName, val);
+    }
+    void handleInterfacesAdded(
+        const std::string& objectPath, const std::string& interface,
+        const std::map<std::string,
+                       phosphor::state::manager::utils::PropertyValue>&
+            properties);
+    bool updatePropertyCache(
+        const std::string& objectPath, const std::string& interface,
+        const std::map<std::string,
+                       phosphor::state::manager::utils::PropertyValue>&
+            properties);
+    void fetchProperty(size_t slot, std::function<void(bool)> callback);
+    void fetchFromService(const std::string& service, size_t slot,
+                          std::function<void(bool)> callback);
+    void getPropertyWithRetries(const std::string& service, size_t slot,
+                                int attempt,
+                                std::function<void(bool)> callback);
     virtual void setPropertyValue(const std::string& propertyName,
                                   const std::string& val) = 0;
 };
 
-class CategoryFeatureReady : public FeatureIntfInherit, StateMachineHandler
+class CategoryFeatureReady :
+    public FeatureIntfInherit,
+    public StateMachineHandler
 {
   public:
-    PropertiesVariant getPropertyValue(const std::string& stateProperty,
-                                       const std::string& propertyValueString)
+    static PropertiesVariant
+        getPropertyValue(const std::string& stateProperty,
+                         const std::string& propertyValueString)
     {
         if (stateProperty == "State")
         {
@@ -157,129 +600,41 @@ class CategoryFeatureReady : public FeatureIntfInherit, StateMachineHandler
                           const std::string& val)
     {
         setPropertyByName(stateProperty, getPropertyValue(stateProperty, val));
+        publishState(stateProperty, val);
     }
 
     CategoryFeatureReady(
-        sdbusplus::bus::bus& bus, const char* objPath,
+        std::shared_ptr<sdbusplus::asio::connection> conn, const char* objPath,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
-        const std::string& errorState, const std::vector<State>& states) :
-        FeatureIntfInherit(bus, objPath),
-        StateMachineHandler(interfaceName, featureType, servicesToBeMonitored,
-                            stateProperty, defaultState, errorState, objPath,
-                            states)
+        const std::string& errorState, std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
+        FeatureIntfInherit(*conn, objPath),
+        StateMachineHandler(conn, interfaceName, featureType,
+                            servicesToBeMonitored, stateProperty, defaultState,
+                            errorState, objPath, debounce, std::move(rules))
     {
         // populate default state
         setPropertyValue(stateProperty, defaultState);
         // populate type
         setPropertyValue("FeatureType", featureType);
 
-        // Register signal handlers before executing initial transition
-        for (const auto& interfaceEntry : servicesToBeMonitored)
-        {
-            const std::string ifaceName = interfaceEntry.first;
-            const std::vector<std::string>& objPaths = interfaceEntry.second;
-
-            for (const std::string& objPath : objPaths)
-            {
-                auto matchPtr = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::propertiesChanged(
-                            std::string(objPath), ifaceName),
-                        [&](sdbusplus::message::message& msg) {
-                    try
-                    {
-                        // Execute the transition when properties change
-                        executeTransition();
-                        // for logging
-                        log<level::INFO>(
-                            (boost::format(
-                                 "Property change triggered state transition, Sender: '%s'") %
-                             msg.get_sender())
-                                .str()
-                                .c_str());
-                    }
-                    catch (const sdbusplus::exception::SdBusError& e)
-                    {
-                        log<level::ERR>("Unable to execute Transiton",
-                                        entry("ERR=%s msg=", e.what()));
-                    }
-                }));
-
-                eventHandlerMatcher.push_back(std::move(matchPtr));
-
-                // create interface added matchPtr
-                auto matchPtr2 = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::interfacesAdded() +
-                            sdbusplus::bus::match::rules::argNpath(
-                                0, std::string(objPath)),
-                        [this, ifaceName](sdbusplus::message::message& msg) {
-                    std::map<std::string,
-                             std::map<std::string, std::variant<std::string>>>
-                        interfacesMap;
-                    sdbusplus::message::object_path path;
-                    msg.read(path, interfacesMap);
-
-                    for (auto& interface : interfacesMap)
-                    {
-                        if (interface.first != ifaceName)
-                        {
-                            continue;
-                        }
-
-                        try
-                        {
-                            // Execute the transition when properties change
-                            executeTransition();
-                            // for logging
-                            log<level::INFO>(
-                                (boost::format(
-                                     "Property change triggered state transition, Sender: '%s'") %
-                                 msg.get_sender())
-                                    .str()
-                                    .c_str());
-                        }
-                        catch (const sdbusplus::exception::SdBusError& e)
-                        {
-                            log<level::ERR>(
-                                "Unable to execute Transiton for interface added matchPtr",
-                                entry("ERR=%s msg=", e.what()));
-                        }
-                    }
-                }));
-
-                // insert interface added matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr2));
-            }
-        }
-
-        // kind of scan if csm comes after any signal is recieved
-        try
-        {
-            // execute transition logic at startup
-            // init for the category
-            executeTransition();
-        }
-        catch (const std::exception& e)
-        {
-            auto errStrPath =
-                (boost::format("CategoryFeatureReady : [E]:%s") % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
-        }
+        // Register signal handlers, the initial transition is run by the
+        // manager once the startup snapshot is in
+        monitorServices();
     }
 };
 
-class CategoryServiceReady : public ServiceIntfInherit, StateMachineHandler
+class CategoryServiceReady :
+    public ServiceIntfInherit,
+    public StateMachineHandler
 {
   public:
-    PropertiesVariant getPropertyValue(const std::string& stateProperty,
-                                       const std::string& propertyValueString)
+    static PropertiesVariant
+        getPropertyValue(const std::string& stateProperty,
+                         const std::string& propertyValueString)
     {
         if (stateProperty == "State")
         {
@@ -295,129 +650,41 @@ class CategoryServiceReady : public ServiceIntfInherit, StateMachineHandler
                           const std::string& val)
     {
         setPropertyByName(stateProperty, getPropertyValue(stateProperty, val));
+        publishState(stateProperty, val);
     }
 
     CategoryServiceReady(
-        sdbusplus::bus::bus& bus, const char* objPath,
+        std::shared_ptr<sdbusplus::asio::connection> conn, const char* objPath,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
-        const std::string& errorState, const std::vector<State>& states) :
-        ServiceIntfInherit(bus, objPath),
-        StateMachineHandler(interfaceName, featureType, servicesToBeMonitored,
-                            stateProperty, defaultState, errorState, objPath,
-                            states)
+        const std::string& errorState, std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
+        ServiceIntfInherit(*conn, objPath),
+        StateMachineHandler(conn, interfaceName, featureType,
+                            servicesToBeMonitored, stateProperty, defaultState,
+                            errorState, objPath, debounce, std::move(rules))
     {
         // populate default state
         setPropertyValue(stateProperty, defaultState);
         // populate type
         setPropertyValue("ServiceType", featureType);
 
-        // Register signal handlers before executing initial transition
-        for (const auto& interfaceEntry : servicesToBeMonitored)
-        {
-            const std::string ifaceName = interfaceEntry.first;
-            const std::vector<std::string>& objPaths = interfaceEntry.second;
-
-            for (const std::string& objPath : objPaths)
-            {
-                auto matchPtr = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::propertiesChanged(
-                            std::string(objPath), ifaceName),
-                        [&](sdbusplus::message::message& msg) {
-                    try
-                    {
-                        // Execute the transition when properties change
-                        executeTransition();
-                        // for logging
-                        log<level::INFO>(
-                            (boost::format(
-                                 "Property change triggered state transition, Sender: '%s'") %
-                             msg.get_sender())
-                                .str()
-                                .c_str());
-                    }
-                    catch (const sdbusplus::exception::SdBusError& e)
-                    {
-                        log<level::ERR>("Unable to execute Transiton",
-                                        entry("ERR=%s msg=", e.what()));
-                    }
-                }));
-
-                eventHandlerMatcher.push_back(std::move(matchPtr));
-
-                // create interface added matchPtr
-                auto matchPtr2 = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::interfacesAdded() +
-                            sdbusplus::bus::match::rules::argNpath(
-                                0, std::string(objPath)),
-                        [this, ifaceName](sdbusplus::message::message& msg) {
-                    std::map<std::string,
-                             std::map<std::string, std::variant<std::string>>>
-                        interfacesMap;
-                    sdbusplus::message::object_path path;
-                    msg.read(path, interfacesMap);
-
-                    for (auto& interface : interfacesMap)
-                    {
-                        if (interface.first != ifaceName)
-                        {
-                            continue;
-                        }
-
-                        try
-                        {
-                            // Execute the transition when properties change
-                            executeTransition();
-                            // for logging
-                            log<level::INFO>(
-                                (boost::format(
-                                     "Property change triggered state transition, Sender: '%s'") %
-                                 msg.get_sender())
-                                    .str()
-                                    .c_str());
-                        }
-                        catch (const sdbusplus::exception::SdBusError& e)
-                        {
-                            log<level::ERR>(
-                                "Unable to execute Transiton for    interface added matchPtr",
-                                entry("ERR=%s msg=", e.what()));
-                        }
-                    }
-                }));
-
-                // insert interface added matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr2));
-            }
-        }
-
-        // kind of scan if csm comes after any signal is recieved
-        try
-        {
-            // execute transition logic at startup
-            // init for the category
-            executeTransition();
-        }
-        catch (const std::exception& e)
-        {
-            auto errStrPath =
-                (boost::format("CategoryServiceReady : [E]:%s") % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
-        }
+        // Register signal handlers, the initial transition is run by the
+        // manager once the startup snapshot is in
+        monitorServices();
     }
 };
 
-class CategoryInterfaceReady : public InterfaceIntfInherit, StateMachineHandler
+class CategoryInterfaceReady :
+    public InterfaceIntfInherit,
+    public StateMachineHandler
 {
   public:
-    PropertiesVariant getPropertyValue(const std::string& stateProperty,
-                                       const std::string& propertyValueString)
+    static PropertiesVariant
+        getPropertyValue(const std::string& stateProperty,
+                         const std::string& propertyValueString)
     {
         if (stateProperty == "State")
         {
@@ -433,129 +700,41 @@ class CategoryInterfaceReady : public InterfaceIntfInherit, StateMachineHandler
                           const std::string& val)
     {
         setPropertyByName(stateProperty, getPropertyValue(stateProperty, val));
+        publishState(stateProperty, val);
     }
 
     CategoryInterfaceReady(
-        sdbusplus::bus_t& bus, const char* objPath,
+        std::shared_ptr<sdbusplus::asio::connection> conn, const char* objPath,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
-        const std::string& errorState, const std::vector<State>& states) :
-        InterfaceIntfInherit(bus, objPath),
-        StateMachineHandler(interfaceName, featureType, servicesToBeMonitored,
-                            stateProperty, defaultState, errorState, objPath,
-                            states)
+        const std::string& errorState, std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
+        InterfaceIntfInherit(*conn, objPath),
+        StateMachineHandler(conn, interfaceName, featureType,
+                            servicesToBeMonitored, stateProperty, defaultState,
+                            errorState, objPath, debounce, std::move(rules))
     {
         // populate default state
         setPropertyValue(stateProperty, defaultState);
         // populate type
         setPropertyValue("InterfaceType", featureType);
 
-        // Register signal handlers before executing initial transition
-        for (const auto& interfaceEntry : servicesToBeMonitored)
-        {
-            const std::string ifaceName = interfaceEntry.first;
-            const std::vector<std::string>& objPaths = interfaceEntry.second;
-
-            for (const std::string& objPath : objPaths)
-            {
-                auto matchPtr = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::propertiesChanged(
-                            std::string(objPath), ifaceName),
-                        [&](sdbusplus::message::message& msg) {
-                    try
-                    {
-                        // Execute the transition when properties change
-                        executeTransition();
-                        // for logging
-                        log<level::INFO>(
-                            (boost::format(
-                                 "Property change triggered state transition, Sender: '%s'") %
-                             msg.get_sender())
-                                .str()
-                                .c_str());
-                    }
-                    catch (const sdbusplus::exception::SdBusError& e)
-                    {
-                        log<level::ERR>("Unable to execute Transiton",
-                                        entry("ERR=%s msg=", e.what()));
-                    }
-                }));
-
-                eventHandlerMatcher.push_back(std::move(matchPtr));
-
-                // create interface added matchPtr
-                auto matchPtr2 = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::interfacesAdded() +
-                            sdbusplus::bus::match::rules::argNpath(
-                                0, std::string(objPath)),
-                        [this, ifaceName](sdbusplus::message::message& msg) {
-                    std::map<std::string,
-                             std::map<std::string, std::variant<std::string>>>
-                        interfacesMap;
-                    sdbusplus::message::object_path path;
-                    msg.read(path, interfacesMap);
-
-                    for (auto& interface : interfacesMap)
-                    {
-                        if (interface.first != ifaceName)
-                        {
-                            continue;
-                        }
-
-                        try
-                        {
-                            // Execute the transition when properties change
-                            executeTransition();
-                            // for logging
-                            log<level::INFO>(
-                                (boost::format(
-                                     "Property change triggered state transition, Sender: '%s'") %
-                                 msg.get_sender())
-                                    .str()
-                                    .c_str());
-                        }
-                        catch (const sdbusplus::exception::SdBusError& e)
-                        {
-                            log<level::ERR>(
-                                "Unable to execute Transiton for    interface added matchPtr",
-                                entry("ERR=%s msg=", e.what()));
-                        }
-                    }
-                }));
-
-                // insert interface added matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr2));
-            }
-        }
-
-        // kind of scan if csm comes after any signal is recieved
-        try
-        {
-            // execute transition logic at startup
-            // init for the category
-            executeTransition();
-        }
-        catch (const std::exception& e)
-        {
-            auto errStrPath =
-                (boost::format("CategoryInterfaceReady : [E]:%s") % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
-        }
+        // Register signal handlers, the initial transition is run by the
+        // manager once the startup snapshot is in
+        monitorServices();
     }
 };
 
-class CategoryDeviceReady : public DeviceIntfInherit, StateMachineHandler
+class CategoryDeviceReady :
+    public DeviceIntfInherit,
+    public StateMachineHandler
 {
   public:
-    PropertiesVariant getPropertyValue(const std::string& stateProperty,
-                                       const std::string& propertyValueString)
+    static PropertiesVariant
+        getPropertyValue(const std::string& stateProperty,
+                         const std::string& propertyValueString)
     {
         if (stateProperty == "State")
         {
@@ -571,128 +750,40 @@ class CategoryDeviceReady : public DeviceIntfInherit, StateMachineHandler
                           const std::string& val)
     {
         setPropertyByName(stateProperty, getPropertyValue(stateProperty, val));
+        publishState(stateProperty, val);
     }
 
     CategoryDeviceReady(
-        sdbusplus::bus_t& bus, const char* objPath,
+        std::shared_ptr<sdbusplus::asio::connection> conn, const char* objPath,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
-        const std::string& errorState, const std::vector<State>& states) :
-        DeviceIntfInherit(bus, objPath),
-        StateMachineHandler(interfaceName, featureType, servicesToBeMonitored,
-                            stateProperty, defaultState, errorState, objPath,
-                            states)
+        const std::string& errorState, std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
+        DeviceIntfInherit(*conn, objPath),
+        StateMachineHandler(conn, interfaceName, featureType,
+                            servicesToBeMonitored, stateProperty, defaultState,
+                            errorState, objPath, debounce, std::move(rules))
     {
         // populate default state
         setPropertyValue(stateProperty, defaultState);
         // populate type
         setPropertyValue("DeviceType", featureType);
 
-        // Register signal handlers before executing initial transition
-        for (const auto& interfaceEntry : servicesToBeMonitored)
-        {
-            const std::string ifaceName = interfaceEntry.first;
-            const std::vector<std::string>& objPaths = interfaceEntry.second;
-
-            for (const std::string& objPath : objPaths)
-            {
-                auto matchPtr = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::propertiesChanged(
-                            std::string(objPath), ifaceName),
-                        [&](sdbusplus::message::message& msg) {
-                    try
-                    {
-                        // Execute the transition when properties change
-                        executeTransition();
-                        // for logging
-                        log<level::INFO>(
-                            (boost::format(
-                                 "Property change triggered state transition, Sender: '%s'") %
-                             msg.get_sender())
-                                .str()
-                                .c_str());
-                    }
-                    catch (const sdbusplus::exception::SdBusError& e)
-                    {
-                        log<level::ERR>("Unable to execute Transiton",
-                                        entry("ERR=%s msg=", e.what()));
-                    }
-                }));
-
-                eventHandlerMatcher.push_back(std::move(matchPtr));
-
-                // create interface added matchPtr
-                auto matchPtr2 = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::interfacesAdded() +
-                            sdbusplus::bus::match::rules::argNpath(
-                                0, std::string(objPath)),
-                        [this, ifaceName](sdbusplus::message::message& msg) {
-                    std::map<std::string,
-                             std::map<std::string, std::variant<std::string>>>
-                        interfacesMap;
-                    sdbusplus::message::object_path path;
-                    msg.read(path, interfacesMap);
-
-                    for (auto& interface : interfacesMap)
-                    {
-                        if (interface.first != ifaceName)
-                        {
-                            continue;
-                        }
-
-                        try
-                        {
-                            // Execute the transition when properties change
-                            executeTransition();
-                            // for logging
-                            log<level::INFO>(
-                                (boost::format(
-                                     "Property change triggered state transition, Sender: '%s'") %
-                                 msg.get_sender())
-                                    .str()
-                                    .c_str());
-                        }
-                        catch (const sdbusplus::exception::SdBusError& e)
-                        {
-                            log<level::ERR>(
-                                "Unable to execute Transiton for    interface added matchPtr",
-                                entry("ERR=%s msg=", e.what()));
-                        }
-                    }
-                }));
-
-                // insert interface added matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr2));
-            }
-        }
-
-        // kind of scan if csm comes after any signal is recieved
-        try
-        {
-            // execute transition logic at startup
-            // init for the category
-            executeTransition();
-        }
-        catch (const std::exception& e)
-        {
-            auto errStrPath =
-                (boost::format("CategoryDeviceReady : [E]:%s") % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
-        }
+        // Register signal handlers, the initial transition is run by the
+        // manager once the startup snapshot is in
+        monitorServices();
     }
 };
 
-class CategoryChassisPowerReady : public ChassisIntfInherit, StateMachineHandler
+class CategoryChassisPowerReady :
+    public ChassisIntfInherit,
+    public StateMachineHandler
 {
   public:
-    PropertiesVariant getPropertyValue(const std::string& propertyValueString)
+    static PropertiesVariant
+        getPropertyValue(const std::string& propertyValueString)
     {
         return convertPowerStateFromString(propertyValueString);
     }
@@ -701,143 +792,271 @@ class CategoryChassisPowerReady : public ChassisIntfInherit, StateMachineHandler
                           const std::string& val)
     {
         setPropertyByName(stateProperty, getPropertyValue(val));
-        // update local cache also
-        localCache[this->objPathCreated] = val;
+        publishState(stateProperty, val);
     }
 
     CategoryChassisPowerReady(
-        sdbusplus::bus_t& bus, const char* objPath,
+        std::shared_ptr<sdbusplus::asio::connection> conn, const char* objPath,
         const std::string& interfaceName, const std::string& featureType,
         const std::unordered_map<std::string, std::vector<std::string>>&
             servicesToBeMonitored,
         const std::string& stateProperty, const std::string& defaultState,
-        const std::string& errorState, const std::vector<State>& states) :
-        ChassisIntfInherit(bus, objPath),
-        StateMachineHandler(interfaceName, featureType, servicesToBeMonitored,
-                            stateProperty, defaultState, errorState, objPath,
-                            states)
+        const std::string& errorState, std::chrono::milliseconds debounce,
+        std::shared_ptr<const RuleSet> rules) :
+        ChassisIntfInherit(*conn, objPath),
+        StateMachineHandler(conn, interfaceName, featureType,
+                            servicesToBeMonitored, stateProperty, defaultState,
+                            errorState, objPath, debounce, std::move(rules))
     {
         // populate default value of state
         setPropertyValue(stateProperty, defaultState);
 
-        // Register signal handlers before executing initial transition
-        for (const auto& interfaceEntry : servicesToBeMonitored)
-        {
-            const std::string ifaceName = interfaceEntry.first;
-            const std::vector<std::string>& objPaths = interfaceEntry.second;
-
-            for (const std::string& objPath : objPaths)
-            {
-                // create propertiesChange matchptr
-                auto matchPtr = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::propertiesChanged(
-                            std::string(objPath), ifaceName),
-                        [&](sdbusplus::message::message& msg) {
-                    try
-                    {
-                        // Execute the transition when properties change
-                        executeTransition();
-                        // for logging
-                        log<level::INFO>(
-                            (boost::format(
-                                 "Property change triggered state transition, Sender: '%s'") %
-                             msg.get_sender())
-                                .str()
-                                .c_str());
-                    }
-                    catch (const sdbusplus::exception::SdBusError& e)
-                    {
-                        log<level::ERR>(
-                            "Unable to execute Transiton for property change matchPtr",
-                            entry("ERR=%s msg=", e.what()));
-                    }
-                }));
-
-                // insert propertiesChange matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr));
-
-                // create interface added matchPtr
-                auto matchPtr2 = std::make_unique<sdbusplus::bus::match::match>(
-                    sdbusplus::bus::match::match(
-                        bus,
-                        sdbusplus::bus::match::rules::interfacesAdded() +
-                            sdbusplus::bus::match::rules::argNpath(
-                                0, std::string(objPath)),
-                        [this, ifaceName](sdbusplus::message::message& msg) {
-                    std::map<std::string,
-                             std::map<std::string, std::variant<std::string>>>
-                        interfacesMap;
-                    sdbusplus::message::object_path path;
-                    msg.read(path, interfacesMap);
-
-                    for (auto& interface : interfacesMap)
-                    {
-                        if (interface.first != ifaceName)
-                        {
-                            continue;
-                        }
-
-                        try
-                        {
-                            // Execute the transition when properties change
-                            executeTransition();
-                            // for logging
-                            log<level::INFO>(
-                                (boost::format(
-                                     "Property change triggered state transition, Sender: '%s'") %
-                                 msg.get_sender())
-                                    .str()
-                                    .c_str());
-                        }
-                        catch (const sdbusplus::exception::SdBusError& e)
-                        {
-                            log<level::ERR>(
-                                "Unable to execute Transiton for    interface added matchPtr",
-                                entry("ERR=%s msg=", e.what()));
-                        }
-                    }
-                }));
-
-                // insert interfacesAdded matchPtr
-                eventHandlerMatcher.push_back(std::move(matchPtr2));
-            }
-        }
-
-        // kind of scan if csm comes after any signal is recieved
-        try
-        {
-            // execute transition logic at startup
-            // init for the category
-            executeTransition();
-        }
-        catch (const std::exception& e)
-        {
-            auto errStrPath =
-                (boost::format("CategoryChassisPowerReady : [E]:%s") % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
-        }
+        // Register signal handlers, the initial transition is run by the
+        // manager once the startup snapshot is in
+        monitorServices();
     }
 };
 
+/** @brief Settings of a state machine as read from its json */
+struct StateMachineConfig
+{
+    std::string interfaceName;
+    std::string featureType;
+    std::string objPath;
+    std::unordered_map<std::string, std::vector<std::string>>
+        servicesToBeMonitored;
+    std::string stateProperty;
+    std::string defaultState;
+    std::chrono::milliseconds debounce;
+    std::chrono::milliseconds stalenessBudget;
+    std::shared_ptr<const RuleSet> rules;
+};
+
 class ConfigurableStateManager
 {
   public:
     // Constructor
-    ConfigurableStateManager() {}
+    ConfigurableStateManager(
+        std::shared_ptr<sdbusplus::asio::connection> conn,
+        std::shared_ptr<sdbusplus::asio::object_server> server,
+        const std::string& objPathRoot, const std::string& folderPath) :
+        conn(std::move(conn)), server(std::move(server)),
+        objPathRoot(objPathRoot), folderPath(folderPath),
+        persistTimer(this->conn->get_io_context())
+    {
+        deserializeStates();
+        deserializeHistory();
+        registerSummary();
+        registerCacheMetrics();
+    }
     // Destructor
     ~ConfigurableStateManager() {}
 
-    /** @brief Parse JSON file  */
-    Json parseConfigFile(const std::string& configFile);
-
-    // Declare vectors to hold the different entity objects
-    std::vector<std::unique_ptr<CategoryFeatureReady>> featureEntities;
-    std::vector<std::unique_ptr<CategoryDeviceReady>> deviceEntities;
-    std::vector<std::unique_ptr<CategoryInterfaceReady>> interfaceEntities;
-    std::vector<std::unique_ptr<CategoryServiceReady>> serviceEntities;
-    std::vector<std::unique_ptr<CategoryChassisPowerReady>> powerEntities;
+    // milliseconds the last good state is kept on errors, unless the json
+    // has a "StalenessBudget". Keeping it is opt-in, without the key the
+    // default state is set on the first error as before.
+    static constexpr int defaultStalenessBudget = 0;
+
+    /** @brief Read the settings of a state machine, throws when the json is
+     *         missing a necessary field or uses an unsupported logic gate
+     *  @param[in] rules - compiled "States" of the json, compiled from data
+     *                     when nullptr */
+    StateMachineConfig
+        parseStateMachine(const Json& data,
+                          std::shared_ptr<const RuleSet> rules = nullptr) const;
+
+    /** @brief Settings of every state machine of a json, one per entry of its
+     *         "Instances" or a single one without. The instances share one
+     *         compiled rule set.
+     *  @param[in] rules - compiled "States" of the json, compiled from data
+     *                     when nullptr */
+    std::vector<StateMachineConfig> parseStateMachines(
+        const Json& data, std::shared_ptr<const RuleSet> rules = nullptr) const;
+
+    /** @brief Settings of the instances of a templated json, config with the
+     *         object path and monitored objects of each, throws when the
+     *         instances would not get an object each
+     *  @param[in] servicesToBeMonitored - as in the json, with the
+     *                                     placeholder */
+    std::vector<StateMachineConfig> instanceConfigs(
+        const StateMachineConfig& config, std::string_view placeholder,
+        std::string_view objectName, const std::vector<std::string>& names,
+        const std::unordered_map<std::string, std::vector<std::string>>&
+            servicesToBeMonitored) const;
+
+    /** @brief Read the "States" block of a json, throws when it is missing a
+     *         necessary field */
+    static std::vector<State> parseStates(const Json& data);
+
+    /** @brief Create the state machines of the json files at startup. When
+     *         the config cache was written for the same json files they are
+     *         created from it without parsing any json, otherwise from the
+     *         json files which are then cached. */
+    void loadConfigFiles(const std::vector<std::string>& configFiles);
+
+    /** @brief Create the state machines of tables generated at build time,
+     *         each under the path of the json file it was generated from.
+     *         A table whose json file is gone is skipped, one whose json
+     *         file changed since the build or which can not be used is left
+     *         to the json file.
+     *  @return the json files of the state machines created */
+    std::set<std::string>
+        loadBuiltinStateMachines(std::span<const BuiltinStateMachine> tables);
+
+    /** @brief Create the state machine of the category named by the
+     *         interface, nullptr for an unknown category */
+    std::unique_ptr<StateMachineHandler>
+        createStateMachine(const StateMachineConfig& config);
+
+    /** @brief Create, rebuild or drop the state machines of a json file so
+     *         that they match the file on disk. The state machines of a json
+     *         which did not change are left untouched.
+     *  @return whether state machines were created */
+    bool loadConfigFile(const std::string& configFile);
+
+    /** @brief Rank the state machines in dependency order, the ones
+     *         depending on each other in a loop, which createEntity() does
+     *         not let in, are rejected */
+    void orderStateMachines();
+
+    /** @brief Let the ServiceCache hold every monitored (object,
+     *         interface) */
+    void sizeServiceCache() const;
+
+    /** @brief The state machines in dependency order */
+    std::vector<StateMachineHandler*> rankedStateMachines() const;
+
+    /** @brief Watch the config directory with inotify and apply the json
+     *         files added, changed or removed at runtime */
+    void watchConfigDirectory();
+
+    /** @brief Resolve the services of all monitored objects with a single
+     *         mapper GetSubTree, read each monitored (object, interface) once
+     *         with GetAll to seed the property caches and then run the
+     *         initial transition of every state machine from memory */
+    void loadSnapshot();
+
+    /** @brief Initial transition of stateMachines, in the given order */
+    void executeInitialTransitions(
+        const std::vector<StateMachineHandler*>& stateMachines);
+
+    struct Entity
+    {
+        // FNV-1a hash of the json file the state machines were built from,
+        // the file is only applied again once it changed
+        uint64_t contentHash = 0;
+        // one per instance of a templated json
+        std::vector<std::unique_ptr<StateMachineHandler>> stateMachines;
+    };
+
+    // state machines of each json file, by file path i.e. in json file order
+    std::map<std::string, Entity> entities;
+
+    /** @brief Write the last good state of every state machine, coalesced
+     *         over persistDelay */
+    void schedulePersist();
+
+  private:
+    void readConfigEvents();
+
+    // state machines the startup snapshot is delivered to while it is
+    // outstanding
+    std::weak_ptr<std::vector<StateMachineHandler*>> snapshotStateMachines;
+
+    /** @brief Replace the state machines of configFile, if any, with the
+     *         ones of configs. Nothing changes unless all of configs are
+     *         valid.
+     *  @return false when configs were rejected */
+    bool createEntity(const std::string& configFile, uint64_t contentHash,
+                      const std::vector<StateMachineConfig>& configs);
+
+    /** @brief Throw when a state machine can not be created from config,
+     *         i.e. its category is unknown, its category does not take a
+     *         value the state machine sets or its object path is invalid or
+     *         taken by a state machine of another json */
+    void validateConfig(const std::string& configFile,
+                        const StateMachineConfig& config) const;
+
+    /** @brief Throw when configs replacing the state machines of configFile
+     *         would close a dependency cycle with the running ones */
+    void validateDependencies(
+        const std::string& configFile,
+        const std::vector<StateMachineConfig>& configs) const;
+
+    /** @brief What a json file is parsed into, as kept in the config cache */
+    struct CachedConfig
+    {
+        std::string configFile;
+        // FNV-1a hash of the content of configFile
+        uint64_t contentHash = 0;
+        // compiled into the rule set shared by the configs
+        std::vector<State> states;
+        std::vector<StateMachineConfig> configs;
+
+        template <class Archive>
+        void serialize(Archive& archive)
+        {
+            archive(configFile, contentHash, states, configs);
+        }
+    };
+
+    // part of the key of the config cache, to be bumped whenever what is
+    // cached changes
+    static constexpr std::string_view configCacheVersion = "2";
+
+    /** @brief Parsed json files of CUSTOM_CONFIG_CACHE_PATH, std::nullopt
+     *         unless it was written for the json files hashed into hash */
+    std::optional<std::vector<CachedConfig>> readConfigCache(uint64_t hash);
+
+    /** @brief Write CUSTOM_CONFIG_CACHE_PATH */
+    void writeConfigCache(uint64_t hash,
+                          const std::vector<CachedConfig>& cached);
+
+    /** @brief Settings of the state machines of a generated table, as
+     *         parseStateMachines() reads them from its json */
+    std::vector<StateMachineConfig>
+        builtinConfigs(const BuiltinStateMachine& table) const;
+
+    /** @brief Serialize the last good states to CUSTOM_STATE_PERSIST_PATH */
+    void serializeStates();
+
+    /** @brief Read the states persisted by the previous run into
+     *         restoredStates */
+    void deserializeStates();
+
+    /** @brief Add summaryInterface to objPathRoot */
+    void registerSummary();
+
+    /** @brief Add metricsInterface to objPathRoot with the counters of the
+     *         ServiceCache */
+    void registerCacheMetrics();
+
+    /** @brief Spill the transition history of every state machine to
+     *         CUSTOM_HISTORY_PATH, nothing when it is empty */
+    void serializeHistory();
+
+    /** @brief Read the history spilled by the previous run into
+     *         restoredHistory */
+    void deserializeHistory();
+
+    std::shared_ptr<sdbusplus::asio::connection> conn;
+    // hosts the csm specific interfaces of the state machine objects
+    std::shared_ptr<sdbusplus::asio::object_server> server;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> summaryIntf;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> cacheMetricsIntf;
+    // objects of the state machines are created below this path
+    std::string objPathRoot;
+    std::string folderPath;
+    std::unique_ptr<boost::asio::posix::stream_descriptor> configWatch;
+    alignas(inotify_event) std::array<char, 4096> configEvents;
+    // states of the previous run by object path, each taken by the first
+    // state machine created for its object
+    std::map<std::string, std::string> restoredStates;
+    // transitions of the previous run by object path, taken like
+    // restoredStates
+    std::map<std::string, std::vector<TransitionRecord>> restoredHistory;
+    static constexpr std::chrono::seconds persistDelay{1};
+    boost::asio::steady_timer persistTimer;
+    bool persistPending = false;
 };
 } // namespace configurable_state_manager
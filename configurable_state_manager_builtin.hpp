@@ -0,0 +1,78 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2021-2024 NVIDIA CORPORATION &
+ * AFFILIATES. All rights reserved. SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace configurable_state_manager
+{
+
+// Tables of the state machines generated at build time from the json files
+// of the configurable-state-manager-builtin-dir option by
+// scripts/configurable_state_manager_tables.py. Each table mirrors the
+// fields of its json, see docs/configurable_state_manager.md.
+
+struct BuiltinCondition
+{
+    std::string_view intf;
+    std::string_view property;
+    // non string values as written in the json
+    std::string_view value;
+    std::string_view logic;
+    uint32_t count;
+    uint32_t holdTime;
+};
+
+struct BuiltinState
+{
+    std::string_view name;
+    std::string_view logic;
+    uint32_t holdTime;
+    std::span<const BuiltinCondition> conditions;
+};
+
+struct BuiltinObjects
+{
+    std::string_view intf;
+    std::span<const std::string_view> objectPaths;
+};
+
+struct BuiltinStateMachine
+{
+    // name of the json file within the config directory
+    std::string_view configFile;
+    // 64 bit FNV-1a hash of the json file, as fnv1a() computes it
+    uint64_t contentHash;
+    std::string_view interfaceName;
+    std::string_view featureType;
+    std::string_view stateProperty;
+    std::string_view defaultState;
+    uint32_t debounce;
+    std::optional<uint32_t> stalenessBudget;
+    // "Instances", a range is expanded to its numbers, no instances
+    // without a placeholder
+    std::string_view placeholder;
+    std::string_view objectName;
+    std::span<const std::string_view> instances;
+    std::span<const BuiltinObjects> servicesToBeMonitored;
+    std::span<const BuiltinState> states;
+};
+
+} // namespace configurable_state_manager
@@ -19,7 +19,23 @@
 #include "configurable_state_manager.hpp"
 #include "utils.hpp"
 
+#ifdef CSM_BUILTIN_TABLES
+#include "configurable_state_manager_builtin_tables.hpp"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <boost/format.hpp>
+#include <cereal/archives/binary.hpp>
+#include <cereal/archives/json.hpp>
+#include <cereal/types/chrono.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/unordered_map.hpp>
+#include <cereal/types/vector.hpp>
 #include <nlohmann/json.hpp>
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/asio/connection.hpp> // Include the asio/connection header
@@ -29,11 +45,17 @@
 #include <sdbusplus/exception.hpp>
 #include <sdbusplus/server.hpp>
 #include <sdbusplus/server/manager.hpp>
+#include <xyz/openbmc_project/ObjectMapper/client.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <set>
+#include <spanstream>
 #include <stdexcept>
 #include <thread>
 #include <variant>
@@ -46,465 +68,3307 @@ namespace configurable_state_manager
 {
 
 using namespace phosphor::logging;
+using ObjectMapper = sdbusplus::client::xyz::openbmc_project::ObjectMapper<>;
+
+namespace
+{
 
-phosphor::state::manager::utils::PropertyValue
-    StateMachineHandler::handleTimeoutRetries(sdbusplus::bus::bus& bus,
-                                              const std::string& objectPath,
-                                              const std::string& interface,
-                                              const std::string& property)
+/** @brief Delay before retrying a Get which timed out on given attempt */
+std::chrono::milliseconds retryDelay(int attempt)
 {
-    constexpr int maxRetries = 4; // Maximum number of retries
-    int retryCount = 0;           // Track retry attempts
+    static std::minstd_rand generator{std::random_device{}()};
 
-    while (retryCount < maxRetries)
+    auto backoff =
+        std::min(StateMachineHandler::retryMaxDelay,
+                 StateMachineHandler::retryBaseDelay * (1 << attempt));
+    // spread the retries of the state machines which timed out together
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(
+        0, backoff.count() / 2);
+    return backoff - std::chrono::milliseconds(jitter(generator));
+}
+
+/** @brief Content of a file without its trailing whitespace, read from the
+ *         start of fd, std::nullopt if it cannot be read */
+std::optional<PropertyValue> readSource(int fd)
+{
+    std::array<char, 256> buffer;
+    ssize_t size = pread(fd, buffer.data(), buffer.size(), 0);
+    if (size < 0)
     {
-        try
-        {
-            // Attempt to fetch the property
-            auto propertyValue = phosphor::state::manager::utils::getPropertyV2(
-                bus, objectPath, interface, property);
+        return std::nullopt;
+    }
+    std::string content(buffer.data(), static_cast<size_t>(size));
+    content.erase(content.find_last_not_of(" \t\n") + 1);
+    return content;
+}
 
-            // Log success and return the retrieved value
-            log<level::INFO>(
-                (boost::format(
-                     "Successfully retrieved property '%s' from object '%s', interface '%s' on retry attempt %d.") %
-                 property % objectPath % interface % (retryCount + 1))
-                    .str()
-                    .c_str());
-            return propertyValue;
-        }
-        catch (const sdbusplus::exception::SdBusError& e)
+/** @brief Object path of a state machine, its TypeInCategory after the last
+ *         '.' below root */
+std::string categoryObjectPath(const std::string& root,
+                               std::string_view featureType)
+{
+    // extract type from Feature Type
+    size_t lastDotPos = featureType.rfind('.');
+    if (lastDotPos != std::string::npos)
+    {
+        featureType.remove_prefix(lastDotPos + 1);
+    }
+    return root + "/" + std::string(featureType);
+}
+
+/** @brief Replace the systemd units listed by name with their object paths */
+void encodeUnitNames(
+    std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored)
+{
+    auto units = servicesToBeMonitored.find(systemdUnitInterface);
+    if (units != servicesToBeMonitored.end())
+    {
+        for (std::string& unit : units->second)
         {
-            if (std::string(e.name()) == "org.freedesktop.DBus.Error.Timeout")
+            if (!unit.starts_with('/'))
             {
-                log<level::WARNING>(
-                    (boost::format(
-                         "Timeout occurred while fetching property '%s' from object '%s', interface '%s'. Retry %d/%d.") %
-                     property % objectPath % interface % (retryCount + 1) %
-                     maxRetries)
-                        .str()
-                        .c_str());
+                unit = unitObjectPath(unit);
             }
-            else
+        }
+    }
+}
+
+/** @brief For each state machine the ones whose object it monitors
+ *  @param[in] objects   - object path of each state machine
+ *  @param[in] monitored - object paths each state machine monitors */
+std::vector<std::vector<size_t>>
+    dependencyGraph(const std::vector<std::string>& objects,
+                    const std::vector<std::vector<std::string>>& monitored)
+{
+    std::unordered_map<std::string_view, size_t> nodeOfObject;
+    for (size_t node = 0; node < objects.size(); ++node)
+    {
+        nodeOfObject.emplace(objects[node], node);
+    }
+    std::vector<std::vector<size_t>> dependencies(objects.size());
+    for (size_t node = 0; node < objects.size(); ++node)
+    {
+        for (const std::string& objectPath : monitored[node])
+        {
+            auto provider = nodeOfObject.find(objectPath);
+            if (provider != nodeOfObject.end() &&
+                std::find(dependencies[node].begin(), dependencies[node].end(),
+                          provider->second) == dependencies[node].end())
             {
-                log<level::ERR>(
-                    (boost::format(
-                         "Unexpected error while fetching property '%s' from object '%s', interface '%s': %s.") %
-                     property % objectPath % interface % e.what())
-                        .str()
-                        .c_str());
-                throw; // Rethrow the exception for non-timeout errors
+                dependencies[node].push_back(provider->second);
             }
         }
+    }
+    return dependencies;
+}
 
-        // Increment retry count and wait before the next attempt
-        ++retryCount;
+/** @brief Object paths of the slots of program */
+std::vector<std::string> monitoredObjectPaths(const RuleProgram& program)
+{
+    std::vector<std::string> objectPaths;
+    for (size_t slot = 0; slot < program.slotCount(); ++slot)
+    {
+        objectPaths.push_back(program.slot(slot).objectPath);
     }
+    return objectPaths;
+}
 
-    // If all retries fail, throw an exception
-    log<level::ERR>(
-        (boost::format(
-             "Failed to retrieve property '%s' from object '%s', interface '%s' after %d attempts. Throwing exception.") %
-         property % objectPath % interface % maxRetries)
-            .str()
-            .c_str());
+/** @brief Throw when Category does not take a value a state machine of
+ *         config sets, i.e. its default state, states and type */
+template <typename Category>
+void validateValues(const StateMachineConfig& config,
+                    const std::string& typeProperty)
+{
+    Category::getPropertyValue(typeProperty, config.featureType);
+    Category::getPropertyValue(config.stateProperty, config.defaultState);
+    for (const CompiledState& state : config.rules->states())
+    {
+        Category::getPropertyValue(config.stateProperty, state.name);
+    }
+}
 
-    throw std::runtime_error(
-        (boost::format(
-             "Unable to retrieve property '%s' from object '%s', interface '%s' after %d attempts.") %
-         property % objectPath % interface % maxRetries)
-            .str());
+} // namespace
+
+// what the config cache keeps of a parsed json, found by cereal through ADL
+template <class Archive>
+void serialize(Archive& archive, Condition& condition)
+{
+    archive(condition.intf, condition.property, condition.value,
+            condition.logic, condition.count, condition.holdTime);
+}
+
+template <class Archive>
+void serialize(Archive& archive, State& state)
+{
+    archive(state.name, state.conditions, state.logic, state.holdTime);
+}
+
+template <class Archive>
+void serialize(Archive& archive, StateMachineConfig& config)
+{
+    // the rules are compiled again from the cached states
+    archive(config.interfaceName, config.featureType, config.objPath,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState, config.debounce, config.stalenessBudget);
+}
+
+// transitions spilled to CUSTOM_HISTORY_PATH
+template <class Archive>
+void serialize(Archive& archive, TransitionRecord& record)
+{
+    archive(record.timestamp, record.oldState, record.newState,
+            record.trigger);
 }
 
-bool StateMachineHandler::any(const std::vector<bool>& bool_vector)
+bool StateMachineHandler::updatePropertyCache(
+    const std::string& objectPath, const std::string& interface,
+    const std::map<std::string, phosphor::state::manager::utils::PropertyValue>&
+        properties)
 {
-    for (bool value : bool_vector)
+    bool changed = false;
+    for (const auto& [property, value] : properties)
     {
-        if (value)
+        // only keep what the conditions of this state machine look at
+        if (auto slot = program.findSlot(objectPath, interface, property))
         {
-            return true;
+            changed = program.setValue(*slot, value) || changed;
         }
     }
-    return false;
+    return changed;
 }
 
-bool StateMachineHandler::all(const std::vector<bool>& bool_vector)
+void StateMachineHandler::fetchProperty(size_t slot,
+                                        std::function<void(bool)> callback)
 {
-    for (bool value : bool_vector)
+    const SlotKey& key = program.slot(slot);
+
+    // GPIO lines and files are kept current by LocalSources
+    if (LocalSources::isLocal(key.intf))
     {
-        if (!value)
+        auto value = LocalSources::instance().find(key.intf, key.objectPath);
+        if (key.property != "Value" || !value)
         {
-            return false;
+            log<level::ERR>(
+                (boost::format("Unable to read '%s' of '%s', interface '%s'") %
+                 key.property % key.objectPath % key.intf)
+                    .str()
+                    .c_str());
+            callback(false);
+            return;
         }
+        program.setValue(slot, *value);
+        callback(true);
+        return;
     }
-    return true;
-}
 
-void StateMachineHandler::executeTransition()
-{
-    auto bus = sdbusplus::bus::new_default();
+    // states of csm itself are read in-process, a Get on the own service
+    // from a handler would deadlock
+    if (auto value = StateRegistry::instance().find(key.objectPath, key.intf,
+                                                    key.property))
+    {
+        program.setValue(slot, *value);
+        callback(true);
+        return;
+    }
+
+    // units are not known to the mapper
+    if (key.intf == systemdUnitInterface)
+    {
+        fetchFromService(systemdService, slot, callback);
+        return;
+    }
 
-    // this loop iterates over each state value which can
-    //  be achieved
-    for (const State& stateValueTransition : states)
+    auto& serviceCache =
+        phosphor::state::manager::utils::ServiceCache::instance();
+    if (auto service = serviceCache.find(key.objectPath, key.intf))
     {
-        std::string stateValue = stateValueTransition.name;
-        std::string stateValueLogic = stateValueTransition.logic;
-        std::vector<bool> evalConditions;
+        fetchFromService(*service, slot, callback);
+        return;
+    }
 
-        // Process conditions to be met to attain the state
-        for (const Condition& condition : stateValueTransition.conditions)
+    // find the service name containing object, intf
+    ++metrics.dbusCalls;
+    conn->async_method_call(
+        [this, guard = std::weak_ptr<bool>(alive), slot, callback](
+            const boost::system::error_code& ec,
+            const std::vector<std::pair<std::string, std::vector<std::string>>>&
+                objects) {
+        if (guard.expired())
         {
-            std::vector<bool> evalConditionLoop;
-            // Iterate over objects associated with condition.intf
-            for (const std::string& objectPath :
-                 servicesToBeMonitored[condition.intf])
-            {
-                // variable to hold output for getProperty
-                phosphor::state::manager::utils::PropertyValue tmp;
-                try
-                {
-                    // find the service name containing object, intf
-                    std::string service =
-                        phosphor::state::manager::utils::getService(
-                            bus, objectPath, condition.intf);
+            return;
+        }
+        const SlotKey& key = program.slot(slot);
+        if (ec || objects.empty())
+        {
+            log<level::ERR>(
+                (boost::format(
+                     "Unable to fetch service name for objectPath::%s, interface::%s, [E]:%s") %
+                 key.objectPath % key.intf % ec.message())
+                    .str()
+                    .c_str());
+            callback(false);
+            return;
+        }
 
-                    // if service is empty set unknown state and return
-                    if (service.empty())
-                    {
-                        log<level::ERR>(
-                            "Unable to fetch service name, setting state as default state");
-                        setPropertyValue(stateProperty, defaultState);
-                        return;
-                    }
+        const std::string& service = objects.begin()->first;
+        phosphor::state::manager::utils::ServiceCache::instance().insert(
+            key.objectPath, key.intf, service);
+        fetchFromService(service, slot, callback);
+    },
+        ObjectMapper::default_service, ObjectMapper::instance_path,
+        ObjectMapper::interface, "GetObject", key.objectPath,
+        std::vector<std::string>({key.intf}));
+}
 
-                    auto errStrPatht =
-                        (boost::format("service name fetched::%s ") % service)
-                            .str();
-                    log<level::ERR>(errStrPatht.c_str());
-                    // if the service hosting the object is csm
-                    // look in local cache
-                    if (service.find("ConfigurableStateManager") !=
-                        std::string::npos)
-                    {
-                        // if property hosted on same service use local cache
-                        // this is kind of local get operation
-                        tmp = localCache[objectPath];
-                    }
-                    else
-                    {
-                        tmp = handleTimeoutRetries(bus, objectPath,
-                                                   condition.intf,
-                                                   condition.property);
-                    }
-                }
-                catch (const std::exception& e)
-                {
-                    auto errStrPath =
-                        (boost::format(
-                             "Got error with getProperty() with multiple tries for combination objectPath::%s, interface::%s, property::%s, with exception:: [E]:%s, hence setting state as default state") %
-                         objectPath % condition.intf % condition.property %
-                         e.what())
-                            .str();
-                    log<level::ERR>(errStrPath.c_str());
-
-                    // set the fallback condition as we are getting error while
-                    // evaluating condition
-                    setPropertyValue(stateProperty, defaultState);
-                    return;
-                }
+void StateMachineHandler::fetchFromService(const std::string& service,
+                                           size_t slot,
+                                           std::function<void(bool)> callback)
+{
+    const SlotKey& key = program.slot(slot);
+    // the value is dropped once the service leaves the bus
+    SignalDemux::instance().addOwner(service, key.objectPath, key.intf);
+    getPropertyWithRetries(service, slot, 0, callback);
+}
 
-                std::string reqValue;
+void StateMachineHandler::getPropertyWithRetries(
+    const std::string& service, size_t slot, int attempt,
+    std::function<void(bool)> callback)
+{
+    const SlotKey& key = program.slot(slot);
 
-                if (std::holds_alternative<int>(tmp))
-                {
-                    int intValue = std::get<int>(tmp);
-                    reqValue = std::to_string(intValue);
-                }
-                else if (std::holds_alternative<std::string>(tmp))
-                {
-                    reqValue = std::get<std::string>(tmp);
-                }
-                else if (std::holds_alternative<bool>(tmp))
-                {
-                    bool boolValue = std::get<bool>(tmp);
-                    reqValue = boolValue ? "true" : "false";
-                }
-                else
-                {
-                    reqValue = "Unsupported Type";
-                }
+    ++metrics.dbusCalls;
+    conn->async_method_call(
+        [this, guard = std::weak_ptr<bool>(alive), service, slot, attempt,
+         callback](const boost::system::error_code& ec,
+                   const phosphor::state::manager::utils::PropertyValue& value) {
+        if (guard.expired())
+        {
+            return;
+        }
+        const SlotKey& key = program.slot(slot);
+        if (!ec)
+        {
+            program.setValue(slot, value);
+            callback(true);
+            return;
+        }
 
-                log<level::INFO>(
-                    (boost::format(
-                         "Parsed property '%s' from object '%s', interface '%s' with value: %s") %
-                     condition.property % objectPath % condition.intf %
-                     reqValue)
-                        .str()
-                        .c_str());
+        if (ec == boost::system::errc::timed_out &&
+            attempt + 1 < maxFetchRetries)
+        {
+            auto delay = retryDelay(attempt);
+            log<level::WARNING>(
+                (boost::format(
+                     "Timeout occurred while fetching property '%s' from object '%s', interface '%s'. Retry %d/%d in %d ms.") %
+                 key.property % key.objectPath % key.intf % (attempt + 1) %
+                 maxFetchRetries % delay.count())
+                    .str()
+                    .c_str());
 
-                int res = condition.value.compare(reqValue);
-                if (res == 0)
+            // the slot stays pending, nothing blocks meanwhile
+            auto& timer = retryTimers[slot];
+            if (!timer)
+            {
+                timer = std::make_unique<boost::asio::steady_timer>(
+                    conn->get_io_context());
+            }
+            timer->expires_after(delay);
+            timer->async_wait([this, service, slot, attempt, callback](
+                                  const boost::system::error_code& ec) {
+                if (ec == boost::asio::error::operation_aborted)
                 {
-                    evalConditionLoop.push_back(true);
+                    // state machine is going away
+                    return;
                 }
-                else
+                if (program.hasValue(slot))
                 {
-                    evalConditionLoop.push_back(false);
+                    // a signal brought the value while waiting
+                    callback(true);
+                    return;
                 }
-            }
+                getPropertyWithRetries(service, slot, attempt + 1, callback);
+            });
+            return;
+        }
 
-            if (condition.logic.compare("AND") == 0)
-            {
-                evalConditions.push_back(all(evalConditionLoop));
-            }
-            else if (condition.logic.compare("OR") == 0)
-            {
-                evalConditions.push_back(any(evalConditionLoop));
-            }
-            else if (condition.logic.empty())
-            {
-                // if no logic is present means only single entry
-                evalConditions.push_back(evalConditionLoop[0]);
-            }
-            else
-            {
-                // other cases of not supported logics
-                log<level::ERR>(
-                    "Unsupported logic gate used, hence setting state as default state");
-                // set state to unknown as feature evaluation got error
-                setPropertyValue(stateProperty, defaultState);
-                return;
-            }
+        log<level::ERR>(
+            (boost::format(
+                 "Failed to retrieve property '%s' from object '%s', interface '%s' after %d attempts, [E]:%s") %
+             key.property % key.objectPath % key.intf % (attempt + 1) %
+             ec.message())
+                .str()
+                .c_str());
+        callback(false);
+    },
+        service, key.objectPath, "org.freedesktop.DBus.Properties", "Get",
+        key.intf, key.property);
+}
+
+StateRegistry& StateRegistry::instance()
+{
+    static StateRegistry registry;
+    return registry;
+}
+
+void StateRegistry::publish(const std::string& objectPath,
+                            const std::string& intf,
+                            const std::string& property,
+                            const std::string& value)
+{
+    std::optional<PropertyValue> before;
+    auto [it, inserted] =
+        objects[objectPath].try_emplace(std::make_pair(intf, property), value);
+    if (!inserted)
+    {
+        if (it->second == PropertyValue(value))
+        {
+            return;
         }
+        before = it->second;
+        it->second = value;
+    }
+    if (held)
+    {
+        // only the first value before hold() is kept
+        heldChanges.try_emplace(std::make_tuple(objectPath, intf, property),
+                                std::move(before));
+        return;
+    }
 
-        // final evaluation of all condition boolean results for a particular
-        // state value
-        bool stateConditionsResult = false;
-        if (stateValueTransition.logic.compare("AND") == 0)
+    addDependents(objectPath, intf, property);
+    // a change published while the wave runs joins it
+    if (!propagating)
+    {
+        propagate();
+    }
+}
+
+void StateRegistry::addDependents(const std::string& objectPath,
+                                  const std::string& intf,
+                                  const std::string& property)
+{
+    auto dependents = subscribers.find(objectPath);
+    if (dependents == subscribers.end())
+    {
+        return;
+    }
+    auto value = find(objectPath, intf, property);
+    for (StateMachineHandler* handler : dependents->second)
+    {
+        bool evaluate =
+            value ? handler->handleStateChanged(objectPath, intf, property,
+                                                *value)
+                  : handler->handleStateRemoved(objectPath, intf, property);
+        if (evaluate)
         {
-            stateConditionsResult = all(evalConditions);
+            wave.emplace(handler->rank, handler);
         }
-        else if (stateValueTransition.logic.compare("OR") == 0)
+    }
+}
+
+void StateRegistry::hold()
+{
+    held = true;
+}
+
+void StateRegistry::release()
+{
+    held = false;
+    auto changes = std::move(heldChanges);
+    heldChanges.clear();
+    for (const auto& [key, before] : changes)
+    {
+        const auto& [objectPath, intf, property] = key;
+        // e.g. the state of a replaced state machine it starts from again
+        if (find(objectPath, intf, property) != before)
         {
-            stateConditionsResult = any(evalConditions);
+            addDependents(objectPath, intf, property);
         }
-        else if (stateValueTransition.logic.empty())
+    }
+    if (!propagating)
+    {
+        propagate();
+    }
+}
+
+void StateRegistry::propagate()
+{
+    propagating = true;
+    while (!wave.empty())
+    {
+        // lowest rank first, what it publishes only affects higher ranks
+        StateMachineHandler* handler = wave.begin()->second;
+        wave.erase(wave.begin());
+        try
         {
-            // if no logic is present means only one condition was there
-            stateConditionsResult = evalConditions[0];
+            handler->executeTransition();
         }
-        else
+        catch (const std::exception& e)
         {
-            // other cases of not supported logics
-            log<level::ERR>("Unsupported logic gate used");
-            return;
+            log<level::ERR>(
+                (boost::format("Transition of %s : [E]:%s") %
+                 handler->objPathCreated % e.what())
+                    .str()
+                    .c_str());
         }
+    }
+    propagating = false;
+}
 
-        // if evaluation is true we set the property and return
-        if (stateConditionsResult)
+void StateRegistry::remove(const std::string& objectPath)
+{
+    auto object = objects.find(objectPath);
+    if (object == objects.end())
+    {
+        return;
+    }
+    auto properties = std::move(object->second);
+    objects.erase(object);
+    for (const auto& [key, value] : properties)
+    {
+        if (held)
         {
-            setPropertyValue(stateProperty, stateValue);
-            return;
+            heldChanges.try_emplace(
+                std::make_tuple(objectPath, key.first, key.second), value);
+        }
+        else
+        {
+            // as for an object of another service going away
+            addDependents(objectPath, key.first, key.second);
         }
     }
+    if (!held && !propagating)
+    {
+        propagate();
+    }
 }
 
-/** @brief Parsing JSON file  */
-Json ConfigurableStateManager::parseConfigFile(const std::string& configFile)
+bool StateRegistry::hosts(const std::string& objectPath) const
 {
-    Json data;
-    // check  json file
-    std::ifstream errhandler_json_file(configFile);
-    if (!errhandler_json_file.good())
+    return objects.contains(objectPath);
+}
+
+std::optional<PropertyValue>
+    StateRegistry::find(const std::string& objectPath, const std::string& intf,
+                        const std::string& property) const
+{
+    auto object = objects.find(objectPath);
+    if (object == objects.end())
     {
-        errhandler_json_file.close();
-        log<level::ERR>("Json  file  not found!",
-                        entry("FILE_NAME=%s", configFile.c_str()));
-        return data;
+        return std::nullopt;
+    }
+    auto it = object->second.find(std::make_pair(intf, property));
+    if (it == object->second.end())
+    {
+        return std::nullopt;
     }
+    return it->second;
+}
 
-    data = Json::parse(errhandler_json_file, nullptr, false);
-    if (data.is_discarded())
+void StateRegistry::subscribe(const std::string& objectPath,
+                              StateMachineHandler* handler)
+{
+    subscribers[objectPath].push_back(handler);
+}
+
+void StateRegistry::unsubscribe(StateMachineHandler* handler)
+{
+    std::erase_if(wave, [handler](const auto& entry) {
+        return entry.second == handler;
+    });
+    for (auto it = subscribers.begin(); it != subscribers.end();)
     {
-        log<level::ERR>("Corrupted Json file",
-                        entry("FILE_NAME=%s", configFile.c_str()));
-        return data;
+        std::erase(it->second, handler);
+        it = it->second.empty() ? subscribers.erase(it) : std::next(it);
     }
-    return data;
 }
 
-} // namespace configurable_state_manager
-////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Service Entry Point
- */
-int main()
+SignalDemux& SignalDemux::instance()
 {
-    log<level::INFO>("Creating Configurable State Manager connection");
-    auto io = std::make_shared<boost::asio::io_context>();
-    auto conn = std::make_shared<sdbusplus::asio::connection>(*io);
+    static SignalDemux demux;
+    return demux;
+}
 
-    // For now, we only have one instance of the configurable state manager
-    auto objPathInst = std::string{CUSTOM_OBJPATH};
+void SignalDemux::attach(sdbusplus::asio::connection& conn)
+{
+    this->conn = &conn;
+    sdbusplus::bus_t& bus = conn;
+    // InterfacesAdded carries the object path as first argument, a single
+    // rule is enough for all the monitored objects. Both signals also keep
+    // the ServiceCache coherent.
+    interfacesAddedMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus, sdbusplus::bus::match::rules::interfacesAdded(),
+        [this](sdbusplus::message::message& msg) { interfacesAdded(msg); });
+    interfacesRemovedMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus, sdbusplus::bus::match::rules::interfacesRemoved(),
+        [this](sdbusplus::message::message& msg) { interfacesRemoved(msg); });
+    // only the names leaving the bus, i.e. without a new owner
+    ownerMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus,
+        sdbusplus::bus::match::rules::nameOwnerChanged() +
+            sdbusplus::bus::match::rules::argN(2, ""),
+        [this](sdbusplus::message::message& msg) { nameOwnerChanged(msg); });
+}
 
-    // Add sdbusplus ObjectManager.
-    sdbusplus::server::manager::manager objManager(*conn, objPathInst.c_str());
-    configurable_state_manager::ConfigurableStateManager manager;
-    conn->request_name(CUSTOM_BUSNAME);
+void SignalDemux::addOwner(const std::string& owner,
+                           const std::string& objectPath,
+                           const std::string& intf)
+{
+    objectsByOwner[owner].emplace(objectPath, intf);
+}
 
-    // Folder path to JSON files
-    std::string folderPath = std::string{CUSTOM_FILEPATH};
-    std::vector<std::string> jsonFiles;
-    for (const auto& filePath : fs::directory_iterator(folderPath))
+void SignalDemux::addNamespace(const std::string& objectPath)
+{
+    for (const auto& [ns, match] : namespaceMatches)
     {
-        if (filePath.is_regular_file() &&
-            filePath.path().extension() == ".json")
+        if (inPathNamespace(objectPath, ns))
         {
-            jsonFiles.push_back(filePath.path().string());
+            return;
         }
     }
 
-    // Sort the JSON file paths alphabetically
-    std::sort(jsonFiles.begin(), jsonFiles.end());
+    std::string ns(pathNamespace(objectPath, namespaceDepth));
+    // a path with fewer components may cover namespaces added before
+    std::erase_if(namespaceMatches, [&ns](const auto& entry) {
+        return inPathNamespace(entry.first, ns);
+    });
+    namespaceMatches.emplace(
+        ns, std::make_unique<sdbusplus::bus::match_t>(
+                static_cast<sdbusplus::bus_t&>(*conn),
+                sdbusplus::bus::match::rules::type::signal() +
+                    sdbusplus::bus::match::rules::member("PropertiesChanged") +
+                    sdbusplus::bus::match::rules::path_namespace(ns) +
+                    sdbusplus::bus::match::rules::interface(
+                        "org.freedesktop.DBus.Properties"),
+                [this](sdbusplus::message::message& msg) {
+        propertiesChanged(msg);
+    }));
+}
 
-    // Process JSON files in alphabetical order
-    for (const auto& jsonFilePath : jsonFiles)
+void SignalDemux::subscribe(const std::string& objectPath,
+                            const std::string& intf,
+                            StateMachineHandler* handler)
+{
+    if (intf == systemdUnitInterface && !jobRemovedMatch)
     {
-        const std::string& configFile = jsonFilePath;
-        Json data = manager.parseConfigFile(configFile);
-        if (data.is_null() || data.is_discarded())
+        watchSystemdUnits();
+    }
+    addNamespace(objectPath);
+    subscribers[objectPath].push_back(Subscriber{intf, handler});
+}
+
+void SignalDemux::watchSystemdUnits()
+{
+    sdbusplus::bus_t& bus = *conn;
+    jobRemovedMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus,
+        sdbusplus::bus::match::rules::type::signal() +
+            sdbusplus::bus::match::rules::member("JobRemoved") +
+            sdbusplus::bus::match::rules::path(systemdObjPath) +
+            sdbusplus::bus::match::rules::interface(systemdManagerInterface),
+        [this](sdbusplus::message::message& msg) { jobRemoved(msg); });
+    systemdOwnerMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus, sdbusplus::bus::match::rules::nameOwnerChanged(systemdService),
+        [this](sdbusplus::message::message& msg) {
+        std::string name;
+        std::string oldOwner;
+        std::string newOwner;
+        msg.read(name, oldOwner, newOwner);
+        if (!newOwner.empty())
         {
-            continue;
+            log<level::INFO>("org.freedesktop.systemd1 is now on dbus");
+            subscribeToSystemd();
         }
-        // debug logging for filename being parsed
-        auto errStr1 = (boost::format("Filename is:%s") % configFile).str();
-        log<level::DEBUG>(errStr1.c_str());
-        try
-        {
-            // Extract the relevant data from the parsed JSON
-            std::string interfaceName = data["InterfaceName"];
-            std::string featureType = data["TypeInCategory"];
-            std::string objToBeAdded = objPathInst + "/";
-            // extract type from Feature Type
-            // Find the last occurrence of '.'
-            size_t lastDotPos = featureType.rfind('.');
-
-            std::string extractedString;
-            // Check if a dot was found
-            if (lastDotPos != std::string::npos)
-            {
-                // Extract the substring after the last dot
-                extractedString = featureType.substr(lastDotPos + 1);
-            }
-            else
-            {
-                extractedString = featureType;
-            }
-            objToBeAdded = objToBeAdded + extractedString;
+    });
+    subscribeToSystemd();
+}
 
-            std::unordered_map<std::string, std::vector<std::string>>
-                servicesToBeMonitored = data["ServicesToBeMonitored"];
-            std::string stateProperty = data["State"]["State_property"];
-            std::string defaultState = data["State"]["Default"];
-            std::string errorState = "";
+void SignalDemux::subscribeToSystemd()
+{
+    // systemd only emits PropertiesChanged of its units to subscribers
+    conn->async_method_call(
+        [](const boost::system::error_code& ec) {
+        if (ec)
+        {
+            // retried once systemd shows up on dbus
+            log<level::ERR>("Failed to subscribe to systemd signals",
+                            entry("ERR=%s", ec.message().c_str()));
+        }
+    },
+        systemdService, systemdObjPath, systemdManagerInterface, "Subscribe");
+}
 
-            std::vector<configurable_state_manager::State> states;
-            // Extract states from JSON
-            for (const auto& stateEntry : data["State"]["States"].items())
-            {
-                // std::string stateName = stateEntry.key();
-                configurable_state_manager::State
-                    state; // Create a State object
-                // Extract state-specific data
-                state.name = stateEntry.key();
-                // optional field
-                state.logic = stateEntry.value().value("Logic", "");
-
-                // Extract conditions
-                for (const auto& conditionEntry :
-                     stateEntry.value()["Conditions"].items())
-                {
-                    configurable_state_manager::Condition condition;
-                    condition.intf = conditionEntry.key();
-                    condition.property = conditionEntry.value()["Property"];
-                    condition.value = conditionEntry.value()["Value"];
-                    // optional field
-                    condition.logic = conditionEntry.value().value("Logic", "");
-                    state.conditions.push_back(condition);
-                }
-                // Add the state to the states vector
-                states.push_back(state);
-            }
+void SignalDemux::jobRemoved(sdbusplus::message::message& msg)
+{
+    uint32_t id = 0;
+    sdbusplus::message::object_path job;
+    std::string unit;
+    std::string result;
+    try
+    {
+        msg.read(id, job, unit, result);
+    }
+    catch (const sdbusplus::exception::SdBusError& e)
+    {
+        log<level::ERR>("Unable to read JobRemoved signal",
+                        entry("ERR=%s", e.what()));
+        return;
+    }
 
-            if (interfaceName.find("FeatureReady") != std::string::npos)
-            {
-                errorState =
-                    "xyz.openbmc_project.State.FeatureReady.States.Unknown";
-                manager.featureEntities.push_back(
-                    std::move(std::make_unique<
-                              configurable_state_manager::CategoryFeatureReady>(
-                        *conn, objToBeAdded.c_str(), interfaceName, featureType,
-                        servicesToBeMonitored, stateProperty, defaultState,
-                        errorState, states)));
+    std::string objectPath = unitObjectPath(unit);
+    auto monitoring = subscribers.find(objectPath);
+    if (monitoring == subscribers.end())
+    {
+        return;
+    }
+    for (const Subscriber& subscriber : monitoring->second)
+    {
+        if (subscriber.intf == systemdUnitInterface)
+        {
+            // shared, counted for each state machine it is read for
+            ++subscriber.handler->metrics.dbusCalls;
+        }
+    }
+
+    // the job may have left the unit in any state, e.g. failed, read it
+    // once for all the state machines monitoring it
+    conn->async_method_call(
+        [this, objectPath](
+            const boost::system::error_code& ec,
+            const std::map<std::string,
+                           phosphor::state::manager::utils::PropertyValue>&
+                properties) {
+        if (ec)
+        {
+            log<level::ERR>(
+                (boost::format("Unable to read unit %s, [E]:%s") % objectPath %
+                 ec.message())
+                    .str()
+                    .c_str());
+            return;
+        }
+        auto it = subscribers.find(objectPath);
+        if (it == subscribers.end())
+        {
+            return;
+        }
+        for (const Subscriber& subscriber : it->second)
+        {
+            if (subscriber.intf == systemdUnitInterface)
+            {
+                subscriber.handler->handlePropertiesChanged(
+                    objectPath, subscriber.intf, properties, {});
+            }
+        }
+    },
+        systemdService, objectPath, "org.freedesktop.DBus.Properties",
+        "GetAll", systemdUnitInterface);
+}
+
+void SignalDemux::subscribePattern(const std::string& pattern,
+                                   const std::string& intf,
+                                   StateMachineHandler* handler)
+{
+    // the objects it matches are all below its root
+    addNamespace(std::string(patternRoot(pattern)));
+    patternSubscribers.push_back(PatternSubscriber{pattern, intf, handler});
+}
+
+void SignalDemux::unsubscribe(StateMachineHandler* handler)
+{
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        std::erase_if(it->second, [handler](const Subscriber& subscriber) {
+            return subscriber.handler == handler;
+        });
+        it = it->second.empty() ? subscribers.erase(it) : std::next(it);
+    }
+    std::erase_if(patternSubscribers,
+                  [handler](const PatternSubscriber& subscriber) {
+        return subscriber.handler == handler;
+    });
+}
+
+void SignalDemux::unsubscribe(const std::string& objectPath,
+                              const std::string& intf,
+                              StateMachineHandler* handler)
+{
+    auto it = subscribers.find(objectPath);
+    if (it == subscribers.end())
+    {
+        return;
+    }
+    std::erase_if(it->second, [&intf, handler](const Subscriber& subscriber) {
+        return subscriber.handler == handler && subscriber.intf == intf;
+    });
+    if (it->second.empty())
+    {
+        subscribers.erase(it);
+    }
+}
+
+void SignalDemux::propertiesChanged(sdbusplus::message::message& msg)
+{
+    auto it = subscribers.find(msg.get_path());
+    // changes of csm states are already handed over by the StateRegistry
+    if (it == subscribers.end() || StateRegistry::instance().hosts(it->first))
+    {
+        return;
+    }
+
+    std::string interface;
+    std::map<std::string, phosphor::state::manager::utils::PropertyValue>
+        changedProperties;
+    std::vector<std::string> invalidatedProperties;
+    try
+    {
+        msg.read(interface, changedProperties, invalidatedProperties);
+    }
+    catch (const sdbusplus::exception::SdBusError& e)
+    {
+        log<level::ERR>(
+            "Unable to read PropertiesChanged signal",
+            entry("ERR=%s", e.what()), entry("PATH=%s", msg.get_path()));
+        return;
+    }
+
+    bool monitored = false;
+    for (const Subscriber& subscriber : it->second)
+    {
+        if (subscriber.intf == interface)
+        {
+            monitored = true;
+            subscriber.handler->handlePropertiesChanged(
+                it->first, interface, changedProperties, invalidatedProperties);
+        }
+    }
+    if (monitored)
+    {
+        // the values go with the sender once it leaves the bus
+        addOwner(msg.get_sender(), it->first, interface);
+    }
+}
+
+void SignalDemux::interfacesAdded(sdbusplus::message::message& msg)
+{
+    sdbusplus::message::object_path path;
+    std::map<std::string,
+             std::map<std::string,
+                      phosphor::state::manager::utils::PropertyValue>>
+        interfacesMap;
+    try
+    {
+        msg.read(path, interfacesMap);
+    }
+    catch (const sdbusplus::exception::SdBusError& e)
+    {
+        log<level::ERR>("Unable to read InterfacesAdded signal",
+                        entry("ERR=%s", e.what()));
+        return;
+    }
+    // the object may now be served by another service
+    phosphor::state::manager::utils::ServiceCache::instance().invalidatePath(
+        path.str);
+
+    if (StateRegistry::instance().hosts(path.str))
+    {
+        return;
+    }
+    auto it = subscribers.find(path.str);
+    if (it != subscribers.end())
+    {
+        for (const Subscriber& subscriber : it->second)
+        {
+            auto interface = interfacesMap.find(subscriber.intf);
+            if (interface != interfacesMap.end())
+            {
+                addOwner(msg.get_sender(), path.str, subscriber.intf);
+                subscriber.handler->handleInterfacesAdded(
+                    path.str, subscriber.intf, interface->second);
+            }
+        }
+    }
+
+    // a new object matching a path pattern, after the subscribers above as
+    // it joins them
+    for (const PatternSubscriber& subscriber : patternSubscribers)
+    {
+        auto interface = interfacesMap.find(subscriber.intf);
+        if (interface != interfacesMap.end() &&
+            matchPathPattern(subscriber.pattern, path.str))
+        {
+            subscriber.handler->addMonitoredObject(path.str, subscriber.intf,
+                                                   interface->second);
+        }
+    }
+}
+
+void SignalDemux::interfacesRemoved(sdbusplus::message::message& msg)
+{
+    sdbusplus::message::object_path path;
+    std::vector<std::string> interfaces;
+    try
+    {
+        msg.read(path, interfaces);
+    }
+    catch (const sdbusplus::exception::SdBusError& e)
+    {
+        log<level::ERR>("Unable to read InterfacesRemoved signal",
+                        entry("ERR=%s", e.what()));
+        return;
+    }
+    phosphor::state::manager::utils::ServiceCache::instance().invalidatePath(
+        path.str);
+
+    for (const PatternSubscriber& subscriber : patternSubscribers)
+    {
+        if (std::find(interfaces.begin(), interfaces.end(),
+                      subscriber.intf) != interfaces.end() &&
+            matchPathPattern(subscriber.pattern, path.str))
+        {
+            subscriber.handler->removeMonitoredObject(path.str,
+                                                      subscriber.intf);
+        }
+    }
+
+    // an object listed explicitly stays monitored, after the patterns above
+    // so that only the state machines still monitoring it are handed over
+    if (StateRegistry::instance().hosts(path.str))
+    {
+        return;
+    }
+    for (const std::string& intf : interfaces)
+    {
+        objectRemoved(path.str, intf);
+    }
+}
+
+void SignalDemux::nameOwnerChanged(sdbusplus::message::message& msg)
+{
+    std::string name;
+    std::string oldOwner;
+    std::string newOwner;
+    try
+    {
+        msg.read(name, oldOwner, newOwner);
+    }
+    catch (const sdbusplus::exception::SdBusError& e)
+    {
+        log<level::ERR>("Unable to read NameOwnerChanged signal",
+                        entry("ERR=%s", e.what()));
+        return;
+    }
+    if (!newOwner.empty())
+    {
+        return;
+    }
+
+    // the objects are known by the unique name of the service from its
+    // signals and by its well known name from the calls made to it, its
+    // old owner when the well known name goes
+    std::set<std::pair<std::string, std::string>> gone;
+    for (const std::string& owner : {name, oldOwner})
+    {
+        auto owned = objectsByOwner.find(owner);
+        if (owned != objectsByOwner.end())
+        {
+            gone.merge(owned->second);
+            objectsByOwner.erase(owned);
+        }
+    }
+    for (const auto& [objectPath, intf] : gone)
+    {
+        objectRemoved(objectPath, intf);
+    }
+}
+
+void SignalDemux::objectRemoved(const std::string& objectPath,
+                                const std::string& intf)
+{
+    auto it = subscribers.find(objectPath);
+    if (it == subscribers.end())
+    {
+        return;
+    }
+    for (const Subscriber& subscriber : it->second)
+    {
+        if (subscriber.intf == intf)
+        {
+            subscriber.handler->handleInterfacesRemoved(objectPath, intf);
+        }
+    }
+}
+
+LocalSources& LocalSources::instance()
+{
+    static LocalSources localSources;
+    return localSources;
+}
+
+LocalSources::Source::~Source()
+{
+    // pending waits complete with operation_aborted
+    descriptor.reset();
+    if (line != nullptr)
+    {
+        gpiod_line_close_chip(line);
+    }
+}
+
+void LocalSources::attach(boost::asio::io_context& io)
+{
+    this->io = &io;
+}
+
+bool LocalSources::isLocal(std::string_view intf)
+{
+    return intf == gpioInterface || intf == fileInterface;
+}
+
+void LocalSources::subscribe(const std::string& intf,
+                             const std::string& source,
+                             StateMachineHandler* handler)
+{
+    auto& entry = sources[std::make_pair(intf, source)];
+    if (!entry)
+    {
+        entry = std::make_unique<Source>();
+        entry->intf = intf;
+        entry->name = source;
+        if (intf == gpioInterface)
+        {
+            openGpio(*entry);
+        }
+        else if (source.starts_with("/sys/"))
+        {
+            openSysfs(*entry);
+        }
+        else
+        {
+            openFile(*entry);
+        }
+    }
+    entry->handlers.push_back(handler);
+}
+
+void LocalSources::unsubscribe(StateMachineHandler* handler)
+{
+    // a source nobody looks at any more is closed
+    std::erase_if(sources, [handler](auto& entry) {
+        std::erase(entry.second->handlers, handler);
+        return entry.second->handlers.empty();
+    });
+}
+
+std::optional<PropertyValue> LocalSources::find(const std::string& intf,
+                                                const std::string& source) const
+{
+    auto it = sources.find(std::make_pair(intf, source));
+    if (it == sources.end())
+    {
+        return std::nullopt;
+    }
+    return it->second->value;
+}
+
+void LocalSources::openGpio(Source& source)
+{
+    source.line = gpiod_line_find(source.name.c_str());
+    if (source.line == nullptr)
+    {
+        log<level::ERR>(
+            (boost::format("GPIO line %s not found") % source.name)
+                .str()
+                .c_str());
+        return;
+    }
+    if (gpiod_line_request_both_edges_events(source.line,
+                                             "configurable-state-manager") !=
+        0)
+    {
+        log<level::ERR>(
+            (boost::format("Failed request for %s GPIO events") % source.name)
+                .str()
+                .c_str());
+        gpiod_line_close_chip(source.line);
+        source.line = nullptr;
+        return;
+    }
+
+    // the line keeps its own fd
+    source.descriptor = std::make_unique<boost::asio::posix::stream_descriptor>(
+        *io, dup(gpiod_line_event_get_fd(source.line)));
+    int value = gpiod_line_get_value(source.line);
+    if (value >= 0)
+    {
+        source.value = value;
+    }
+    waitGpio(source);
+}
+
+void LocalSources::waitGpio(Source& source)
+{
+    source.descriptor->async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        [this, &source](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        if (ec)
+        {
+            log<level::ERR>(
+                (boost::format("Stopped watching GPIO %s, [E]:%s") %
+                 source.name % ec.message())
+                    .str()
+                    .c_str());
+            update(source, std::nullopt);
+            return;
+        }
+
+        // consume the edge, the level is read after it so that a burst of
+        // edges ends on the current level
+        gpiod_line_event event;
+        gpiod_line_event_read(source.line, &event);
+        int value = gpiod_line_get_value(source.line);
+        update(source, value < 0 ? std::nullopt
+                                 : std::optional<PropertyValue>(value));
+        waitGpio(source);
+    });
+}
+
+void LocalSources::openSysfs(Source& source)
+{
+    int fd = open(source.name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        log<level::ERR>((boost::format("Unable to open %s, [E]:%s") %
+                         source.name % strerror(errno))
+                            .str()
+                            .c_str());
+        return;
+    }
+    source.descriptor =
+        std::make_unique<boost::asio::posix::stream_descriptor>(*io, fd);
+    // reading arms the notification of the attribute
+    source.value = readSource(fd);
+    waitSysfs(source);
+}
+
+void LocalSources::waitSysfs(Source& source)
+{
+    // sysfs_notify() wakes up POLLPRI
+    source.descriptor->async_wait(
+        boost::asio::posix::stream_descriptor::wait_error,
+        [this, &source](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        if (ec)
+        {
+            log<level::ERR>((boost::format("Stopped watching %s, [E]:%s") %
+                             source.name % ec.message())
+                                .str()
+                                .c_str());
+            update(source, std::nullopt);
+            return;
+        }
+        update(source, readSource(source.descriptor->native_handle()));
+        waitSysfs(source);
+    });
+}
+
+void LocalSources::openFile(Source& source)
+{
+    fs::path path(source.name);
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // the directory, so that a file replaced by a rename is seen as well
+    if (fd < 0 ||
+        inotify_add_watch(fd, path.parent_path().c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                              IN_DELETE | IN_MOVED_FROM) < 0)
+    {
+        log<level::ERR>((boost::format("Unable to watch %s, [E]:%s") %
+                         source.name % strerror(errno))
+                            .str()
+                            .c_str());
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+    source.descriptor =
+        std::make_unique<boost::asio::posix::stream_descriptor>(*io, fd);
+
+    int file = open(source.name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file >= 0)
+    {
+        source.value = readSource(file);
+        close(file);
+    }
+    waitFile(source);
+}
+
+void LocalSources::waitFile(Source& source)
+{
+    source.descriptor->async_read_some(
+        boost::asio::buffer(source.events),
+        [this, &source](const boost::system::error_code& ec, size_t size) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        if (ec)
+        {
+            log<level::ERR>((boost::format("Stopped watching %s, [E]:%s") %
+                             source.name % ec.message())
+                                .str()
+                                .c_str());
+            update(source, std::nullopt);
+            return;
+        }
+
+        std::string fileName = fs::path(source.name).filename().string();
+        bool touched = false;
+        for (size_t offset = 0; offset + sizeof(inotify_event) <= size;)
+        {
+            inotify_event event;
+            std::memcpy(&event, source.events.data() + offset, sizeof(event));
+            const char* name = source.events.data() + offset + sizeof(event);
+            offset += sizeof(event) + event.len;
+            touched = touched || (event.len > 0 &&
+                                  fileName == std::string_view(
+                                                  name, strnlen(name,
+                                                                event.len)));
+        }
+        if (touched)
+        {
+            std::optional<PropertyValue> value;
+            int file = open(source.name.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file >= 0)
+            {
+                value = readSource(file);
+                close(file);
+            }
+            update(source, value);
+        }
+        waitFile(source);
+    });
+}
+
+void LocalSources::update(Source& source, std::optional<PropertyValue> value)
+{
+    if (source.value == value)
+    {
+        return;
+    }
+    source.value = value;
+    for (StateMachineHandler* handler : source.handlers)
+    {
+        if (value)
+        {
+            handler->handlePropertiesChanged(source.name, source.intf,
+                                             {{"Value", *value}}, {});
+        }
+        else
+        {
+            // fetched again on evaluation, which then fails
+            handler->handlePropertiesChanged(source.name, source.intf, {},
+                                             {"Value"});
+        }
+    }
+}
+
+void StateMachineHandler::monitorServices()
+{
+    for (const auto& [ifaceName, objPaths] : monitoredObjects)
+    {
+        for (const std::string& objPath : objPaths)
+        {
+            if (LocalSources::isLocal(ifaceName))
+            {
+                LocalSources::instance().subscribe(ifaceName, objPath, this);
+                continue;
+            }
+            SignalDemux::instance().subscribe(objPath, ifaceName, this);
+            StateRegistry::instance().subscribe(objPath, this);
+        }
+    }
+    // objects matching a pattern are added and removed as they come and go,
+    // the initial ones are resolved with the startup snapshot
+    for (const auto& [ifaceName, patterns] : pathPatterns)
+    {
+        for (const std::string& pattern : patterns)
+        {
+            SignalDemux::instance().subscribePattern(pattern, ifaceName, this);
+        }
+    }
+}
+
+bool StateMachineHandler::monitorObject(const std::string& objectPath,
+                                        const std::string& interface)
+{
+    auto& objectPaths = monitoredObjects[interface];
+    if (std::find(objectPaths.begin(), objectPaths.end(), objectPath) !=
+        objectPaths.end())
+    {
+        return false;
+    }
+    objectPaths.push_back(objectPath);
+    SignalDemux::instance().subscribe(objectPath, interface, this);
+    log<level::INFO>(
+        (boost::format("Monitoring '%s' interface '%s' for '%s'") %
+         objectPath % interface % objPathCreated)
+            .str()
+            .c_str());
+    return true;
+}
+
+void StateMachineHandler::addPatternMatches(const SubTree& subtree)
+{
+    bool added = false;
+    for (const auto& [objectPath, services] : subtree)
+    {
+        // csm objects have to be listed explicitly
+        if (StateRegistry::instance().hosts(objectPath))
+        {
+            continue;
+        }
+        for (const auto& [intf, patterns] : pathPatterns)
+        {
+            bool implemented = std::any_of(
+                services.begin(), services.end(), [&intf](const auto& service) {
+                return std::find(service.second.begin(), service.second.end(),
+                                 intf) != service.second.end();
+            });
+            bool matched = std::any_of(
+                patterns.begin(), patterns.end(),
+                [&objectPath](const std::string& pattern) {
+                return matchPathPattern(pattern, objectPath);
+            });
+            if (implemented && matched)
+            {
+                added = monitorObject(objectPath, intf) || added;
+            }
+        }
+    }
+    // once for all the matches
+    if (added)
+    {
+        rebuildProgram();
+    }
+}
+
+void StateMachineHandler::resolvePathPatterns(std::function<void()> callback)
+{
+    std::vector<std::string> interfaces;
+    for (const auto& [intf, patterns] : pathPatterns)
+    {
+        interfaces.push_back(intf);
+    }
+    if (interfaces.empty())
+    {
+        callback();
+        return;
+    }
+
+    ++metrics.dbusCalls;
+    conn->async_method_call(
+        [this, guard = std::weak_ptr<bool>(alive),
+         callback](const boost::system::error_code& ec,
+                   const SubTree& subtree) {
+        if (guard.expired())
+        {
+            return;
+        }
+        if (ec)
+        {
+            log<level::ERR>(
+                (boost::format(
+                     "Unable to resolve the path patterns of %s, [E]:%s") %
+                 objPathCreated % ec.message())
+                    .str()
+                    .c_str());
+        }
+        else
+        {
+            addPatternMatches(subtree);
+        }
+        callback();
+    },
+        ObjectMapper::default_service, ObjectMapper::instance_path,
+        ObjectMapper::interface, "GetSubTree", "/", 0, interfaces);
+}
+
+void StateMachineHandler::addMonitoredObject(
+    const std::string& objectPath, const std::string& interface,
+    const std::map<std::string, phosphor::state::manager::utils::PropertyValue>&
+        properties)
+{
+    if (!monitorObject(objectPath, interface))
+    {
+        // already handed over as InterfacesAdded of a monitored object
+        return;
+    }
+    rebuildProgram();
+    updatePropertyCache(objectPath, interface, properties);
+    trigger = objectPath + " " + interface;
+    if (started)
+    {
+        scheduleTransition();
+    }
+}
+
+void StateMachineHandler::removeMonitoredObject(const std::string& objectPath,
+                                                const std::string& interface)
+{
+    // an object listed explicitly stays
+    auto listed = servicesToBeMonitored.find(interface);
+    if (listed != servicesToBeMonitored.end() &&
+        std::find(listed->second.begin(), listed->second.end(), objectPath) !=
+            listed->second.end())
+    {
+        return;
+    }
+    auto objectPaths = monitoredObjects.find(interface);
+    if (objectPaths == monitoredObjects.end() ||
+        std::erase(objectPaths->second, objectPath) == 0)
+    {
+        return;
+    }
+
+    SignalDemux::instance().unsubscribe(objectPath, interface, this);
+    log<level::INFO>(
+        (boost::format("Stopped monitoring '%s' interface '%s' for '%s'") %
+         objectPath % interface % objPathCreated)
+            .str()
+            .c_str());
+    rebuildProgram();
+    trigger = objectPath + " " + interface;
+    if (started)
+    {
+        scheduleTransition();
+    }
+}
+
+void StateMachineHandler::rebuildProgram()
+{
+    // outstanding replies and retries refer to slots of the old program,
+    // they are dropped and the next transition fetches what is missing
+    alive = std::make_shared<bool>(true);
+    retryTimers.clear();
+    fetching.clear();
+    // the holds start over with the results of the new program
+    holdTimers.clear();
+    holdGenerations.clear();
+
+    RuleProgram rebuilt(program.sharedRuleSet(), monitoredObjects);
+    rebuilt.adoptValues(program);
+    program = std::move(rebuilt);
+    retryTimers.resize(program.slotCount());
+    fetching.resize(program.slotCount());
+    holdTimers.resize(program.holdCount());
+    holdGenerations.resize(program.holdCount());
+}
+
+bool StateMachineHandler::handleStateChanged(const std::string& objectPath,
+                                             const std::string& interface,
+                                             const std::string& property,
+                                             const PropertyValue& value)
+{
+    auto slot = program.findSlot(objectPath, interface, property);
+    if (!slot || !program.setValue(*slot, value))
+    {
+        return false;
+    }
+    trigger = objectPath + " " + interface + " " + property;
+    return started;
+}
+
+void StateMachineHandler::handleInterfacesRemoved(
+    const std::string& objectPath, const std::string& interface)
+{
+    // fetched again on evaluation, the state falls back when the object is
+    // not back by then
+    if (!program.clearValues(objectPath, interface))
+    {
+        return;
+    }
+    trigger = objectPath + " " + interface + " removed";
+    if (started)
+    {
+        scheduleTransition();
+    }
+}
+
+bool StateMachineHandler::handleStateRemoved(const std::string& objectPath,
+                                             const std::string& interface,
+                                             const std::string& property)
+{
+    auto slot = program.findSlot(objectPath, interface, property);
+    if (!slot || !program.hasValue(*slot))
+    {
+        return false;
+    }
+    // fetched again on evaluation, like an invalidated property
+    program.clearValue(*slot);
+    trigger = objectPath + " " + interface + " removed";
+    return started;
+}
+
+void StateMachineHandler::handlePropertiesChanged(
+    const std::string& objectPath, const std::string& interface,
+    const std::map<std::string, phosphor::state::manager::utils::PropertyValue>&
+        changedProperties,
+    const std::vector<std::string>& invalidatedProperties)
+{
+    bool changed = updatePropertyCache(objectPath, interface,
+                                       changedProperties);
+    // invalidated values are fetched again on evaluation
+    for (const auto& property : invalidatedProperties)
+    {
+        if (auto slot = program.findSlot(objectPath, interface, property))
+        {
+            program.clearValue(*slot);
+            changed = true;
+        }
+    }
+    if (!changed)
+    {
+        // no condition looks at what changed
+        return;
+    }
+
+    // Execute the transition when properties change
+    trigger = objectPath + " " + interface;
+    scheduleTransition();
+    // routine, the transitions it causes are kept in the history
+    log<level::DEBUG>(
+        (boost::format(
+             "Property change on '%s' triggered state transition of '%s'") %
+         objectPath % objPathCreated)
+            .str()
+            .c_str());
+}
+
+void StateMachineHandler::handleInterfacesAdded(
+    const std::string& objectPath, const std::string& interface,
+    const std::map<std::string, phosphor::state::manager::utils::PropertyValue>&
+        properties)
+{
+    if (!updatePropertyCache(objectPath, interface, properties))
+    {
+        return;
+    }
+
+    // Execute the transition when interface is added
+    trigger = objectPath + " " + interface;
+    scheduleTransition();
+    // routine, the transitions it causes are kept in the history
+    log<level::DEBUG>(
+        (boost::format(
+             "Interface added on '%s' triggered state transition of '%s'") %
+         objectPath % objPathCreated)
+            .str()
+            .c_str());
+}
+
+void StateMachineHandler::executeTransition()
+{
+    started = true;
+    if (!roundStart)
+    {
+        roundStart = std::chrono::steady_clock::now();
+    }
+
+    // from what is known, the states needing a value which is not are
+    // decided once it is back
+    evaluateStates();
+
+    // issue a Get for every combination neither known nor being fetched at
+    // once and evaluate again when the last one is back. A fetch still
+    // outstanding, e.g. waiting for a retry, re-runs the transition itself.
+    std::vector<size_t> missing;
+    for (size_t slot = 0; slot < program.slotCount(); ++slot)
+    {
+        if (!program.hasValue(slot) && !fetching[slot])
+        {
+            missing.push_back(slot);
+        }
+    }
+    if (missing.empty())
+    {
+        return;
+    }
+    auto pending = std::make_shared<size_t>(missing.size());
+    auto failed = std::make_shared<bool>(false);
+    for (size_t slot : missing)
+    {
+        fetching[slot] = true;
+    }
+    for (size_t slot : missing)
+    {
+        fetchProperty(slot, [this, slot, pending, failed](bool success) {
+            fetching[slot] = false;
+            *failed = *failed || !success;
+            if (--(*pending) > 0)
+            {
+                return;
+            }
+
+            if (*failed)
+            {
+                ++metrics.fetchErrors;
+                if (program.decided())
+                {
+                    // the state reported does not need what failed
+                    return;
+                }
+                // the round ends without an evaluation
+                roundStart.reset();
+                // keep the last good state while revalidating, the fallback
+                // is only set once the staleness budget runs out
+                markStale();
+                return;
+            }
+            executeTransition();
+        });
+    }
+}
+
+void StateMachineHandler::scheduleTransition()
+{
+    // the latency counts from the trigger, the debounce included
+    if (!roundStart)
+    {
+        roundStart = std::chrono::steady_clock::now();
+    }
+    if (debounce.count() == 0)
+    {
+        executeTransition();
+        return;
+    }
+
+    // the changes arriving until the timer fires are already in the program
+    // and get evaluated together
+    if (debouncePending)
+    {
+        return;
+    }
+    debouncePending = true;
+    debounceTimer.expires_after(debounce);
+    debounceTimer.async_wait([this](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            // state machine is going away
+            return;
+        }
+        debouncePending = false;
+        executeTransition();
+    });
+}
+
+void StateMachineHandler::evaluateStates()
+{
+    // first state value whose conditions are met is set
+    auto state = program.evaluate();
+    updateHoldTimers();
+    if (!program.decided())
+    {
+        // a state before it waits for a value being fetched
+        return;
+    }
+    markFresh();
+    ++metrics.evaluations;
+    if (state)
+    {
+        setLastGoodState(program.ruleSet().states()[*state].name);
+        reportState(*lastGoodState);
+    }
+    else if (provisionalState)
+    {
+        // the state of the previous run does not hold any more
+        reportState(defaultState);
+    }
+    clearProvisional();
+    if (roundStart)
+    {
+        // from the trigger through the fetches to the state reported
+        metrics.recordLatency(std::chrono::steady_clock::now() - *roundStart);
+        roundStart.reset();
+    }
+}
+
+void StateMachineHandler::updateHoldTimers()
+{
+    // a completion already queued when the timer is cancelled or re-armed
+    // still runs with success, the generation tells it is stale
+    for (uint32_t hold : program.holdsStopped())
+    {
+        ++holdGenerations[hold];
+        if (holdTimers[hold])
+        {
+            holdTimers[hold]->cancel();
+        }
+    }
+    for (uint32_t hold : program.holdsStarted())
+    {
+        auto& timer = holdTimers[hold];
+        if (!timer)
+        {
+            timer = std::make_unique<boost::asio::steady_timer>(
+                conn->get_io_context());
+        }
+        // a change in between cancels it, nothing polls
+        timer->expires_after(program.holdTime(hold));
+        timer->async_wait([this, guard = std::weak_ptr<bool>(alive), hold,
+                           generation = ++holdGenerations[hold]](
+                              const boost::system::error_code& ec) {
+            if (ec == boost::asio::error::operation_aborted ||
+                guard.expired() || holdGenerations[hold] != generation)
+            {
+                return;
+            }
+            program.holdElapsed(hold);
+            trigger = "HoldTime";
+            executeTransition();
+        });
+    }
+}
+
+void StateMachineHandler::setLastGoodState(std::optional<std::string> state)
+{
+    if (lastGoodState == state)
+    {
+        return;
+    }
+    lastGoodState = std::move(state);
+    if (onStateChanged)
+    {
+        onStateChanged();
+    }
+}
+
+void StateMachineHandler::reportState(const std::string& state)
+{
+    setPropertyValue(stateProperty, state);
+    if (state == reportedState)
+    {
+        return;
+    }
+
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    history.record(
+        {static_cast<uint64_t>(now.count()), reportedState, state, trigger});
+    reportedState = state;
+    reportedSince = static_cast<uint64_t>(now.count());
+    ++metrics.transitions;
+    lastChange = std::chrono::steady_clock::now();
+    if (onStateChanged)
+    {
+        // spills the history along with the states
+        onStateChanged();
+    }
+}
+
+void StateMachineHandler::restoreState(const std::string& state,
+                                       const std::string& source)
+{
+    const auto& states = program.ruleSet().states();
+    if (std::none_of(states.begin(), states.end(),
+                     [&state](const CompiledState& compiled) {
+        return compiled.name == state;
+    }))
+    {
+        log<level::INFO>(
+            (boost::format(
+                 "%s %s of %s is not a state of its json, ignoring it") %
+             source % state % objPathCreated)
+                .str()
+                .c_str());
+        return;
+    }
+
+    try
+    {
+        trigger = source;
+        reportState(state);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>(
+            (boost::format("Failed to restore state %s of %s, [E]:%s") %
+             state % objPathCreated % e.what())
+                .str()
+                .c_str());
+        return;
+    }
+    provisionalState = state;
+    if (statusIntf)
+    {
+        statusIntf->set_property("Provisional", true);
+    }
+}
+
+void StateMachineHandler::clearProvisional()
+{
+    if (!provisionalState)
+    {
+        return;
+    }
+    provisionalState.reset();
+    if (statusIntf)
+    {
+        statusIntf->set_property("Provisional", false);
+    }
+}
+
+void StateMachineHandler::registerStatus(
+    std::shared_ptr<sdbusplus::asio::object_server> objectServer,
+    std::chrono::milliseconds stalenessBudget)
+{
+    this->objectServer = std::move(objectServer);
+    this->stalenessBudget = stalenessBudget;
+    statusIntf = this->objectServer->add_interface(objPathCreated,
+                                                   statusInterface);
+    statusIntf->register_property("Stale", false);
+    // milliseconds since epoch the state is stale, 0 when it is not
+    statusIntf->register_property("StaleSince", uint64_t(0));
+    statusIntf->register_property(
+        "StalenessBudget", static_cast<uint64_t>(stalenessBudget.count()));
+    // set while the state persisted by the previous run is reported
+    statusIntf->register_property("Provisional", false);
+    // the last transitions, oldest first: milliseconds since epoch, old
+    // state, new state and what triggered it
+    statusIntf->register_method("GetTransitionHistory", [this]() {
+        std::vector<
+            std::tuple<uint64_t, std::string, std::string, std::string>>
+            transitions;
+        for (TransitionRecord& record : history.records())
+        {
+            transitions.emplace_back(record.timestamp,
+                                     std::move(record.oldState),
+                                     std::move(record.newState),
+                                     std::move(record.trigger));
+        }
+        return transitions;
+    });
+    statusIntf->initialize();
+}
+
+void StateMachineHandler::registerMetrics()
+{
+    metricsIntf = objectServer->add_interface(objPathCreated,
+                                              metricsInterface);
+    // getters only, updating a property on every evaluation would cost a
+    // PropertiesChanged signal each
+    auto getter = [this](auto member) {
+        return [this, member](const uint64_t&) { return metrics.*member; };
+    };
+    metricsIntf->register_property_r(
+        "Evaluations", uint64_t(0), sdbusplus::vtable::property_::none,
+        getter(&EvaluationMetrics::evaluations));
+    metricsIntf->register_property_r(
+        "Transitions", uint64_t(0), sdbusplus::vtable::property_::none,
+        getter(&EvaluationMetrics::transitions));
+    metricsIntf->register_property_r(
+        "DBusCalls", uint64_t(0), sdbusplus::vtable::property_::none,
+        getter(&EvaluationMetrics::dbusCalls));
+    metricsIntf->register_property_r(
+        "FetchErrors", uint64_t(0), sdbusplus::vtable::property_::none,
+        getter(&EvaluationMetrics::fetchErrors));
+    metricsIntf->register_property_r(
+        "DefaultFallbacks", uint64_t(0), sdbusplus::vtable::property_::none,
+        getter(&EvaluationMetrics::defaultFallbacks));
+    metricsIntf->register_property_r(
+        "LatencyHistogram", std::vector<uint64_t>(),
+        sdbusplus::vtable::property_::none,
+        [this](const std::vector<uint64_t>&) {
+        return std::vector<uint64_t>(metrics.latencyHistogram.begin(),
+                                     metrics.latencyHistogram.end());
+    });
+    // exclusive upper bounds in microseconds of all but the last bucket
+    std::vector<uint64_t> bounds;
+    for (size_t bucket = 0; bucket + 1 < EvaluationMetrics::latencyBuckets;
+         ++bucket)
+    {
+        bounds.push_back(EvaluationMetrics::latencyBucketBound(bucket));
+    }
+    metricsIntf->register_property("LatencyBucketBoundsUs", bounds);
+    // milliseconds since the state reported last changed, or since the
+    // state machine was created
+    metricsIntf->register_property_r(
+        "TimeSinceLastChange", uint64_t(0),
+        sdbusplus::vtable::property_::none, [this](const uint64_t&) {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - lastChange)
+                .count());
+    });
+    metricsIntf->initialize();
+}
+
+void StateMachineHandler::markStale()
+{
+    if (!stale)
+    {
+        stale = true;
+        if (statusIntf)
+        {
+            auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch());
+            statusIntf->set_property("Stale", true);
+            statusIntf->set_property("StaleSince",
+                                     static_cast<uint64_t>(now.count()));
+        }
+
+        // a state restored from the previous run counts as good until a
+        // live evaluation replaces it
+        const std::optional<std::string>& keptState =
+            lastGoodState ? lastGoodState : provisionalState;
+        if (!keptState || stalenessBudget.count() == 0)
+        {
+            // nothing good to keep
+            log<level::ERR>(
+                (boost::format(
+                     "Got error with getProperty() for %s, hence setting state as default state") %
+                 objPathCreated)
+                    .str()
+                    .c_str());
+            setLastGoodState(std::nullopt);
+            trigger = "FetchError";
+            reportState(defaultState);
+            ++metrics.defaultFallbacks;
+            clearProvisional();
+            return;
+        }
+
+        log<level::WARNING>(
+            (boost::format(
+                 "Got error with getProperty() for %s, keeping state %s for up to %d ms") %
+             objPathCreated % *keptState % stalenessBudget.count())
+                .str()
+                .c_str());
+        staleTimer.expires_after(stalenessBudget);
+        staleTimer.async_wait([this](const boost::system::error_code& ec) {
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            // set the fallback condition as we are getting error while
+            // evaluating condition
+            log<level::ERR>(
+                (boost::format(
+                     "State of %s stale for longer than %d ms, hence setting state as default state") %
+                 objPathCreated % stalenessBudget.count())
+                    .str()
+                    .c_str());
+            setLastGoodState(std::nullopt);
+            revalidateTimer.cancel();
+            trigger = "StalenessBudget";
+            reportState(defaultState);
+            ++metrics.defaultFallbacks;
+            clearProvisional();
+        });
+    }
+    else if (!lastGoodState && !provisionalState)
+    {
+        // budget ran out, signals bring the state back as before
+        return;
+    }
+
+    // revalidate in the background while the last good state is kept
+    revalidateTimer.expires_after(revalidateInterval);
+    revalidateTimer.async_wait([this](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        executeTransition();
+    });
+}
+
+void StateMachineHandler::markFresh()
+{
+    if (!stale)
+    {
+        return;
+    }
+    stale = false;
+    staleTimer.cancel();
+    revalidateTimer.cancel();
+    if (statusIntf)
+    {
+        statusIntf->set_property("Stale", false);
+        statusIntf->set_property("StaleSince", uint64_t(0));
+    }
+}
+
+void ConfigurableStateManager::loadSnapshot()
+{
+    // ranked once for all replies, a reload meanwhile refreshes it
+    auto stateMachines = std::make_shared<std::vector<StateMachineHandler*>>(
+        rankedStateMachines());
+    snapshotStateMachines = stateMachines;
+
+    std::vector<std::string> interfaces;
+    // the calls of the snapshot are counted for each state machine they
+    // are made for
+    std::vector<StateMachineHandler*> participants;
+    for (StateMachineHandler* stateMachine : *stateMachines)
+    {
+        size_t count = interfaces.size();
+        const RuleProgram& program = stateMachine->program;
+        for (size_t slot = 0; slot < program.slotCount(); ++slot)
+        {
+            // local sources are read as they are watched
+            if (!LocalSources::isLocal(program.slot(slot).intf))
+            {
+                interfaces.push_back(program.slot(slot).intf);
+            }
+        }
+        // the same lookup resolves the path patterns
+        for (const auto& [intf, patterns] : stateMachine->pathPatterns)
+        {
+            interfaces.push_back(intf);
+        }
+        if (interfaces.size() > count)
+        {
+            participants.push_back(stateMachine);
+        }
+    }
+    std::sort(interfaces.begin(), interfaces.end());
+    interfaces.erase(std::unique(interfaces.begin(), interfaces.end()),
+                     interfaces.end());
+    if (interfaces.empty())
+    {
+        executeInitialTransitions(*stateMachines);
+        return;
+    }
+
+    // one lookup for the services of all monitored objects
+    for (StateMachineHandler* stateMachine : participants)
+    {
+        ++stateMachine->metrics.dbusCalls;
+    }
+    conn->async_method_call(
+        [this, stateMachines](const boost::system::error_code& ec,
+                              const SubTree& subtree) {
+        if (ec)
+        {
+            log<level::ERR>(
+                (boost::format(
+                     "Unable to get the startup snapshot, fetching per property, [E]:%s") %
+                 ec.message())
+                    .str()
+                    .c_str());
+            executeInitialTransitions(*stateMachines);
+            return;
+        }
+
+        for (StateMachineHandler* stateMachine : *stateMachines)
+        {
+            stateMachine->addPatternMatches(subtree);
+        }
+
+        // monitored (object, interface) grouped by the owning service
+        std::map<std::string, std::set<std::pair<std::string, std::string>>>
+            objectsByService;
+        // the state machines each (object, interface) is read for
+        std::map<std::pair<std::string, std::string>,
+                 std::set<StateMachineHandler*>>
+            readers;
+        auto& serviceCache =
+            phosphor::state::manager::utils::ServiceCache::instance();
+        for (StateMachineHandler* stateMachine : *stateMachines)
+        {
+            const RuleProgram& program = stateMachine->program;
+            for (size_t slot = 0; slot < program.slotCount(); ++slot)
+            {
+                const SlotKey& key = program.slot(slot);
+                if (StateRegistry::instance().hosts(key.objectPath))
+                {
+                    // read from the registry on evaluation
+                    continue;
+                }
+                auto object = subtree.find(key.objectPath);
+                if (object == subtree.end())
+                {
+                    // not on dbus yet, InterfacesAdded will bring it
+                    continue;
+                }
+                for (const auto& [service, intfs] : object->second)
+                {
+                    if (std::find(intfs.begin(), intfs.end(), key.intf) ==
+                        intfs.end())
+                    {
+                        continue;
+                    }
+                    serviceCache.insert(key.objectPath, key.intf, service);
+                    SignalDemux::instance().addOwner(service, key.objectPath,
+                                                     key.intf);
+                    objectsByService[service].emplace(key.objectPath,
+                                                      key.intf);
+                    readers[std::make_pair(key.objectPath, key.intf)].insert(
+                        stateMachine);
+                    break;
+                }
+            }
+        }
+
+        auto pending = std::make_shared<size_t>(0);
+        for (const auto& [service, objects] : objectsByService)
+        {
+            *pending += objects.size();
+        }
+        if (*pending == 0)
+        {
+            executeInitialTransitions(*stateMachines);
+            return;
+        }
+
+        for (const auto& [service, objects] : objectsByService)
+        {
+            for (const auto& [objectPath, intf] : objects)
+            {
+                for (StateMachineHandler* stateMachine :
+                     readers[std::make_pair(objectPath, intf)])
+                {
+                    ++stateMachine->metrics.dbusCalls;
+                }
+                conn->async_method_call(
+                    [this, stateMachines, objectPath, intf,
+                     pending](const boost::system::error_code& ec,
+                              const std::map<std::string,
+                                             phosphor::state::manager::utils::
+                                                 PropertyValue>& properties) {
+                    if (ec)
+                    {
+                        // left unknown, fetched per property on evaluation
+                        log<level::DEBUG>(
+                            (boost::format(
+                                 "GetAll failed for '%s' interface '%s', [E]:%s") %
+                             objectPath % intf % ec.message())
+                                .str()
+                                .c_str());
+                    }
+                    else
+                    {
+                        for (StateMachineHandler* stateMachine :
+                             *stateMachines)
+                        {
+                            stateMachine->updatePropertyCache(objectPath, intf,
+                                                              properties);
+                        }
+                    }
+
+                    if (--(*pending) == 0)
+                    {
+                        executeInitialTransitions(*stateMachines);
+                    }
+                },
+                    service, objectPath, "org.freedesktop.DBus.Properties",
+                    "GetAll", intf);
+            }
+        }
+    },
+        ObjectMapper::default_service, ObjectMapper::instance_path,
+        ObjectMapper::interface, "GetSubTree", "/", 0, interfaces);
+}
+
+void ConfigurableStateManager::executeInitialTransitions(
+    const std::vector<StateMachineHandler*>& stateMachines)
+{
+    for (StateMachineHandler* stateMachine : stateMachines)
+    {
+        try
+        {
+            // kind of scan if csm comes after any signal is recieved
+            stateMachine->trigger = "Startup";
+            stateMachine->executeTransition();
+        }
+        catch (const std::exception& e)
+        {
+            log<level::ERR>(
+                (boost::format("Initial transition of %s : [E]:%s") %
+                 stateMachine->objPathCreated % e.what())
+                    .str()
+                    .c_str());
+        }
+    }
+}
+
+StateMachineConfig ConfigurableStateManager::parseStateMachine(
+    const Json& data, std::shared_ptr<const RuleSet> rules) const
+{
+    StateMachineConfig config;
+    // Extract the relevant data from the parsed JSON
+    config.interfaceName = data.at("InterfaceName").get<std::string>();
+    config.featureType = data.at("TypeInCategory").get<std::string>();
+    config.objPath = categoryObjectPath(objPathRoot, config.featureType);
+
+    config.servicesToBeMonitored =
+        data.at("ServicesToBeMonitored")
+            .get<std::unordered_map<std::string, std::vector<std::string>>>();
+    encodeUnitNames(config.servicesToBeMonitored);
+    config.stateProperty =
+        data.at("State").at("State_property").get<std::string>();
+    config.defaultState = data.at("State").at("Default").get<std::string>();
+    // optional field, settle window in milliseconds
+    config.debounce = std::chrono::milliseconds(data.value("Debounce", 0));
+    // optional field, how long the last good state is kept on errors
+    config.stalenessBudget = std::chrono::milliseconds(
+        data.value("StalenessBudget", defaultStalenessBudget));
+    if (rules)
+    {
+        config.rules = std::move(rules);
+        return config;
+    }
+
+    // compile the rules once, rejects unsupported logic gates
+    config.rules = std::make_shared<const RuleSet>(parseStates(data));
+    return config;
+}
+
+std::vector<State> ConfigurableStateManager::parseStates(const Json& data)
+{
+    std::vector<State> states;
+    // Extract states from JSON
+    for (const auto& stateEntry : data.at("State").at("States").items())
+    {
+        State state; // Create a State object
+        // Extract state-specific data
+        state.name = stateEntry.key();
+        // optional field
+        state.logic = stateEntry.value().value("Logic", "");
+        // optional field, milliseconds the state has to hold
+        state.holdTime =
+            std::chrono::milliseconds(stateEntry.value().value("HoldTime", 0));
+
+        // Extract conditions
+        for (const auto& conditionEntry :
+             stateEntry.value().at("Conditions").items())
+        {
+            Condition condition;
+            condition.intf = conditionEntry.key();
+            condition.property =
+                conditionEntry.value().at("Property").get<std::string>();
+            // compared against the property in its own type once compiled,
+            // non string values are taken as written
+            const auto& value = conditionEntry.value().at("Value");
+            condition.value = value.is_string() ? value.get<std::string>()
+                                                : value.dump();
+            // optional field
+            condition.logic = conditionEntry.value().value("Logic", "");
+            // necessary field for the count based logic gates
+            if (condition.logic == "AtLeast" || condition.logic == "AtMost")
+            {
+                condition.count =
+                    conditionEntry.value().at("Count").get<uint32_t>();
+            }
+            // optional field, milliseconds the condition has to hold
+            condition.holdTime = std::chrono::milliseconds(
+                conditionEntry.value().value("HoldTime", 0));
+            state.conditions.push_back(condition);
+        }
+        // Add the state to the states vector
+        states.push_back(state);
+    }
+    return states;
+}
+
+std::vector<StateMachineConfig> ConfigurableStateManager::parseStateMachines(
+    const Json& data, std::shared_ptr<const RuleSet> rules) const
+{
+    auto instances = data.find("Instances");
+    if (instances == data.end())
+    {
+        return {parseStateMachine(data, std::move(rules))};
+    }
+
+    // a name per instance, from a list or an inclusive range of numbers
+    auto placeholder = instances->at("Placeholder").get<std::string>();
+    std::vector<std::string> names;
+    if (instances->contains("List"))
+    {
+        names = instances->at("List").get<std::vector<std::string>>();
+    }
+    else
+    {
+        auto range = instances->at("Range").get<std::array<int, 2>>();
+        for (int index = range[0]; index <= range[1]; ++index)
+        {
+            names.push_back(std::to_string(index));
+        }
+    }
+
+    // TypeInCategory stays the same for all the instances, each gets its own
+    // object from the expanded ObjectName
+    return instanceConfigs(
+        parseStateMachine(data, std::move(rules)), placeholder,
+        instances->at("ObjectName").get<std::string>(), names,
+        data.at("ServicesToBeMonitored")
+            .get<std::unordered_map<std::string, std::vector<std::string>>>());
+}
+
+std::vector<StateMachineConfig> ConfigurableStateManager::instanceConfigs(
+    const StateMachineConfig& config, std::string_view placeholder,
+    std::string_view objectName, const std::vector<std::string>& names,
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored) const
+{
+    // the states are compiled once for all the instances, only the object
+    // paths differ between them
+    std::vector<StateMachineConfig> configs;
+    for (Instance& instance :
+         expandInstances(placeholder, objectName, names,
+                         servicesToBeMonitored, *config.rules))
+    {
+        StateMachineConfig instanceConfig = config;
+        instanceConfig.objPath = objPathRoot + "/" + instance.objectName;
+        instanceConfig.servicesToBeMonitored =
+            std::move(instance.servicesToBeMonitored);
+        // unit names given with the placeholder are encoded once expanded
+        encodeUnitNames(instanceConfig.servicesToBeMonitored);
+        configs.push_back(std::move(instanceConfig));
+    }
+    return configs;
+}
+
+std::unique_ptr<StateMachineHandler>
+    ConfigurableStateManager::createStateMachine(
+        const StateMachineConfig& config)
+{
+    const char* objPath = config.objPath.c_str();
+    std::unique_ptr<StateMachineHandler> stateMachine;
+    if (config.interfaceName.find("FeatureReady") != std::string::npos)
+    {
+        stateMachine = std::make_unique<CategoryFeatureReady>(
+            conn, objPath, config.interfaceName, config.featureType,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState,
+            "xyz.openbmc_project.State.FeatureReady.States.Unknown",
+            config.debounce, config.rules);
+    }
+    else if (config.interfaceName.find("DeviceReady") != std::string::npos)
+    {
+        stateMachine = std::make_unique<CategoryDeviceReady>(
+            conn, objPath, config.interfaceName, config.featureType,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState,
+            "xyz.openbmc_project.State.DeviceReady.States.Unknown",
+            config.debounce, config.rules);
+    }
+    else if (config.interfaceName.find("InterfaceReady") != std::string::npos)
+    {
+        stateMachine = std::make_unique<CategoryInterfaceReady>(
+            conn, objPath, config.interfaceName, config.featureType,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState,
+            "xyz.openbmc_project.State.InterfaceReady.States.Unknown",
+            config.debounce, config.rules);
+    }
+    else if (config.interfaceName.find("ServiceReady") != std::string::npos)
+    {
+        stateMachine = std::make_unique<CategoryServiceReady>(
+            conn, objPath, config.interfaceName, config.featureType,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState,
+            "xyz.openbmc_project.State.ServiceReady.States.Unknown",
+            config.debounce, config.rules);
+    }
+    else if (config.interfaceName.find("State.Chassis") != std::string::npos)
+    {
+        stateMachine = std::make_unique<CategoryChassisPowerReady>(
+            conn, objPath, config.interfaceName, config.featureType,
+            config.servicesToBeMonitored, config.stateProperty,
+            config.defaultState,
+            "xyz.openbmc_project.State.Chassis.PowerState.Unknown",
+            config.debounce, config.rules);
+    }
+    if (stateMachine)
+    {
+        stateMachine->registerStatus(server, config.stalenessBudget);
+        stateMachine->registerMetrics();
+        stateMachine->onStateChanged = [this]() { schedulePersist(); };
+        auto history = restoredHistory.find(config.objPath);
+        if (history != restoredHistory.end())
+        {
+            for (TransitionRecord& record : history->second)
+            {
+                stateMachine->history.record(std::move(record));
+            }
+            restoredHistory.erase(history);
+        }
+        auto restored = restoredStates.find(config.objPath);
+        if (restored != restoredStates.end())
+        {
+            stateMachine->restoreState(restored->second);
+            restoredStates.erase(restored);
+        }
+    }
+    return stateMachine;
+}
+
+void ConfigurableStateManager::schedulePersist()
+{
+    if (persistPending)
+    {
+        return;
+    }
+    persistPending = true;
+    persistTimer.expires_after(persistDelay);
+    persistTimer.async_wait([this](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        persistPending = false;
+        serializeStates();
+        serializeHistory();
+    });
+}
+
+void ConfigurableStateManager::serializeStates()
+{
+    std::map<std::string, std::string> states;
+    for (const StateMachineHandler* stateMachine : rankedStateMachines())
+    {
+        if (stateMachine->lastGoodState)
+        {
+            states.emplace(stateMachine->objPathCreated,
+                           *stateMachine->lastGoodState);
+        }
+        else if (stateMachine->provisionalState)
+        {
+            states.emplace(stateMachine->objPathCreated,
+                           *stateMachine->provisionalState);
+        }
+    }
+
+    fs::path path{CUSTOM_STATE_PERSIST_PATH};
+    // written aside and renamed over the old file, a reboot meanwhile leaves
+    // either the old or the new states
+    fs::path tmpPath{path.string() + ".tmp"};
+    try
+    {
+        fs::create_directories(path.parent_path());
+        {
+            std::ofstream os(tmpPath.c_str(), std::ios::binary);
+            cereal::JSONOutputArchive oarchive(os);
+            oarchive(states);
+        }
+        fs::rename(tmpPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>(
+            (boost::format("Failed to persist the states to %s, [E]:%s") %
+             path.string() % e.what())
+                .str()
+                .c_str());
+    }
+}
+
+void ConfigurableStateManager::deserializeStates()
+{
+    fs::path path{CUSTOM_STATE_PERSIST_PATH};
+    try
+    {
+        if (fs::exists(path))
+        {
+            std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+            cereal::JSONInputArchive iarchive(is);
+            iarchive(restoredStates);
+        }
+    }
+    catch (const cereal::Exception& e)
+    {
+        log<level::ERR>((boost::format("deserialize exception: %s") % e.what())
+                            .str()
+                            .c_str());
+        restoredStates.clear();
+        fs::remove(path);
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        restoredStates.clear();
+    }
+}
+
+void ConfigurableStateManager::registerSummary()
+{
+    summaryIntf = server->add_interface(objPathRoot, summaryInterface);
+    // one reply for a full readiness poll, built from what the state
+    // machines hold: object path, category interface, type, state and
+    // milliseconds since epoch the state was set
+    summaryIntf->register_method("GetStates", [this]() {
+        std::vector<std::tuple<sdbusplus::message::object_path, std::string,
+                               std::string, std::string, uint64_t>>
+            states;
+        for (const StateMachineHandler* stateMachine : rankedStateMachines())
+        {
+            states.emplace_back(stateMachine->objPathCreated,
+                                stateMachine->interfaceName,
+                                stateMachine->featureType,
+                                stateMachine->reportedState,
+                                stateMachine->reportedSince);
+        }
+        return states;
+    });
+    summaryIntf->initialize();
+}
+
+void ConfigurableStateManager::registerCacheMetrics()
+{
+    using phosphor::state::manager::utils::ServiceCache;
+    // process wide, next to the metrics of each state machine object
+    cacheMetricsIntf = server->add_interface(objPathRoot, metricsInterface);
+    auto getter = [](auto member) {
+        return [member](const uint64_t&) {
+            return static_cast<uint64_t>((ServiceCache::instance().*member)());
+        };
+    };
+    cacheMetricsIntf->register_property_r("ServiceCacheHits", uint64_t(0),
+                                          sdbusplus::vtable::property_::none,
+                                          getter(&ServiceCache::hits));
+    cacheMetricsIntf->register_property_r("ServiceCacheMisses", uint64_t(0),
+                                          sdbusplus::vtable::property_::none,
+                                          getter(&ServiceCache::misses));
+    cacheMetricsIntf->register_property_r("ServiceCacheEntries", uint64_t(0),
+                                          sdbusplus::vtable::property_::none,
+                                          getter(&ServiceCache::size));
+    cacheMetricsIntf->register_property_r("ServiceCacheCapacity", uint64_t(0),
+                                          sdbusplus::vtable::property_::none,
+                                          getter(&ServiceCache::capacity));
+    cacheMetricsIntf->initialize();
+}
+
+void ConfigurableStateManager::sizeServiceCache() const
+{
+    // every monitored (object, interface) is resolved once at startup, they
+    // would evict each other from a smaller cache
+    std::set<std::pair<std::string, std::string>> objects;
+    for (const auto& [configFile, entity] : entities)
+    {
+        for (const auto& stateMachine : entity.stateMachines)
+        {
+            const RuleProgram& program = stateMachine->program;
+            for (size_t slot = 0; slot < program.slotCount(); ++slot)
+            {
+                objects.emplace(program.slot(slot).objectPath,
+                                program.slot(slot).intf);
             }
-            else if (interfaceName.find("DeviceReady") != std::string::npos)
+        }
+    }
+    phosphor::state::manager::utils::ServiceCache::instance().reserve(
+        objects.size());
+}
+
+void ConfigurableStateManager::serializeHistory()
+{
+    std::string_view historyPath{CUSTOM_HISTORY_PATH};
+    if (historyPath.empty())
+    {
+        return;
+    }
+
+    std::map<std::string, std::vector<TransitionRecord>> histories;
+    for (const StateMachineHandler* stateMachine : rankedStateMachines())
+    {
+        histories.emplace(stateMachine->objPathCreated,
+                          stateMachine->history.records());
+    }
+
+    fs::path path{historyPath};
+    fs::path tmpPath{path.string() + ".tmp"};
+    try
+    {
+        fs::create_directories(path.parent_path());
+        {
+            std::ofstream os(tmpPath.c_str(), std::ios::binary);
+            cereal::BinaryOutputArchive oarchive(os);
+            oarchive(histories);
+        }
+        fs::rename(tmpPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>(
+            (boost::format("Failed to spill the history to %s, [E]:%s") %
+             path.string() % e.what())
+                .str()
+                .c_str());
+    }
+}
+
+void ConfigurableStateManager::deserializeHistory()
+{
+    std::string_view historyPath{CUSTOM_HISTORY_PATH};
+    if (historyPath.empty())
+    {
+        return;
+    }
+
+    fs::path path{historyPath};
+    try
+    {
+        if (fs::exists(path))
+        {
+            std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+            cereal::BinaryInputArchive iarchive(is);
+            iarchive(restoredHistory);
+        }
+    }
+    catch (const cereal::Exception& e)
+    {
+        log<level::ERR>((boost::format("deserialize exception: %s") % e.what())
+                            .str()
+                            .c_str());
+        restoredHistory.clear();
+        fs::remove(path);
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        restoredHistory.clear();
+    }
+}
+
+std::vector<StateMachineConfig>
+    ConfigurableStateManager::builtinConfigs(
+        const BuiltinStateMachine& table) const
+{
+    // the rules are compiled once for all the instances
+    std::vector<State> states;
+    for (const BuiltinState& builtinState : table.states)
+    {
+        State state{std::string(builtinState.name),
+                    {},
+                    std::string(builtinState.logic),
+                    std::chrono::milliseconds(builtinState.holdTime)};
+        for (const BuiltinCondition& builtinCondition : builtinState.conditions)
+        {
+            state.conditions.push_back(
+                {std::string(builtinCondition.intf),
+                 std::string(builtinCondition.property),
+                 std::string(builtinCondition.value),
+                 std::string(builtinCondition.logic), builtinCondition.count,
+                 std::chrono::milliseconds(builtinCondition.holdTime)});
+        }
+        states.push_back(std::move(state));
+    }
+
+    StateMachineConfig config;
+    config.interfaceName = table.interfaceName;
+    config.featureType = table.featureType;
+    config.objPath = categoryObjectPath(objPathRoot, config.featureType);
+    for (const BuiltinObjects& objects : table.servicesToBeMonitored)
+    {
+        config.servicesToBeMonitored[std::string(objects.intf)].assign(
+            objects.objectPaths.begin(), objects.objectPaths.end());
+    }
+    config.stateProperty = table.stateProperty;
+    config.defaultState = table.defaultState;
+    config.debounce = std::chrono::milliseconds(table.debounce);
+    config.stalenessBudget = std::chrono::milliseconds(
+        table.stalenessBudget.value_or(defaultStalenessBudget));
+    config.rules = std::make_shared<const RuleSet>(states);
+
+    // a table without instances is a single state machine
+    if (table.placeholder.empty())
+    {
+        encodeUnitNames(config.servicesToBeMonitored);
+        return {std::move(config)};
+    }
+    return instanceConfigs(config, table.placeholder, table.objectName,
+                           std::vector<std::string>(table.instances.begin(),
+                                                    table.instances.end()),
+                           config.servicesToBeMonitored);
+}
+
+std::set<std::string> ConfigurableStateManager::loadBuiltinStateMachines(
+    std::span<const BuiltinStateMachine> tables)
+{
+    std::set<std::string> configFiles;
+    for (const BuiltinStateMachine& table : tables)
+    {
+        std::string configFile =
+            (fs::path(folderPath) / table.configFile).string();
+        // the table only stands for the json file it was generated from,
+        // which is hashed, not parsed
+        std::ifstream file(configFile, std::ios::binary);
+        if (!file.good())
+        {
+            log<level::INFO>(
+                (boost::format(
+                     "Json file %s of the built-in state machine is gone, skipping it") %
+                 configFile)
+                    .str()
+                    .c_str());
+            continue;
+        }
+        std::string content{std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>()};
+        if (fnv1a(content) != table.contentHash)
+        {
+            // the json file is parsed instead
+            log<level::INFO>(
+                (boost::format(
+                     "Json file %s changed since the build, not using its built-in state machine") %
+                 configFile)
+                    .str()
+                    .c_str());
+            continue;
+        }
+        try
+        {
+            // a change of the file on disk replaces it
+            if (createEntity(configFile, table.contentHash,
+                             builtinConfigs(table)))
             {
-                errorState =
-                    "xyz.openbmc_project.State.DeviceReady.States.Unknown";
-                manager.deviceEntities.push_back(
-                    std::move(std::make_unique<
-                              configurable_state_manager::CategoryDeviceReady>(
-                        *conn, objToBeAdded.c_str(), interfaceName, featureType,
-                        servicesToBeMonitored, stateProperty, defaultState,
-                        errorState, states)));
+                configFiles.insert(configFile);
             }
-            else if (interfaceName.find("InterfaceReady") != std::string::npos)
+        }
+        catch (const std::exception& e)
+        {
+            // the json file is tried instead
+            log<level::ERR>(
+                (boost::format(
+                     "Built-in state machine of %s rejected, [E]:%s") %
+                 configFile % e.what())
+                    .str()
+                    .c_str());
+        }
+    }
+    return configFiles;
+}
+
+bool ConfigurableStateManager::loadConfigFile(const std::string& configFile)
+{
+    auto entity = entities.find(configFile);
+    if (!fs::exists(configFile))
+    {
+        if (entity != entities.end())
+        {
+            log<level::INFO>(
+                (boost::format("Removing state machine of %s") % configFile)
+                    .str()
+                    .c_str());
+            entities.erase(entity);
+            schedulePersist();
+        }
+        return false;
+    }
+
+    std::ifstream file(configFile, std::ios::binary);
+    if (!file.good())
+    {
+        log<level::ERR>("Json  file  not found!",
+                        entry("FILE_NAME=%s", configFile.c_str()));
+        return false;
+    }
+    std::string content{std::istreambuf_iterator<char>(file),
+                        std::istreambuf_iterator<char>()};
+    uint64_t contentHash = fnv1a(content);
+    if (entity != entities.end() && entity->second.contentHash == contentHash)
+    {
+        // unchanged, keeps its state and dbus object
+        return false;
+    }
+    Json data = Json::parse(content, nullptr, false);
+    if (data.is_discarded())
+    {
+        log<level::ERR>("Corrupted Json file",
+                        entry("FILE_NAME=%s", configFile.c_str()));
+        // a corrupt json leaves the running state machine as is
+        return false;
+    }
+
+    // debug logging for filename being parsed
+    auto errStr1 = (boost::format("Filename is:%s") % configFile).str();
+    log<level::DEBUG>(errStr1.c_str());
+    try
+    {
+        // so does one missing a necessary field
+        std::vector<StateMachineConfig> configs = parseStateMachines(data);
+        return createEntity(configFile, contentHash, configs);
+    }
+    catch (std::exception& e)
+    {
+        auto errStrPath =
+            (boost::format("Corrupted Json file, Filename is:%s, [E]:%s") %
+             configFile % e.what())
+                .str();
+        log<level::ERR>(errStrPath.c_str());
+        return false;
+    }
+}
+
+void ConfigurableStateManager::validateConfig(
+    const std::string& configFile, const StateMachineConfig& config) const
+{
+    if (config.interfaceName.find("FeatureReady") != std::string::npos)
+    {
+        validateValues<CategoryFeatureReady>(config, "FeatureType");
+    }
+    else if (config.interfaceName.find("DeviceReady") != std::string::npos)
+    {
+        validateValues<CategoryDeviceReady>(config, "DeviceType");
+    }
+    else if (config.interfaceName.find("InterfaceReady") != std::string::npos)
+    {
+        validateValues<CategoryInterfaceReady>(config, "InterfaceType");
+    }
+    else if (config.interfaceName.find("ServiceReady") != std::string::npos)
+    {
+        validateValues<CategoryServiceReady>(config, "ServiceType");
+    }
+    else if (config.interfaceName.find("State.Chassis") != std::string::npos)
+    {
+        CategoryChassisPowerReady::getPropertyValue(config.defaultState);
+        for (const CompiledState& state : config.rules->states())
+        {
+            CategoryChassisPowerReady::getPropertyValue(state.name);
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("Unknown category " +
+                                    config.interfaceName);
+    }
+
+    if (!sd_bus_object_path_is_valid(config.objPath.c_str()))
+    {
+        throw std::invalid_argument("Invalid object path " + config.objPath);
+    }
+    for (const auto& [otherFile, entity] : entities)
+    {
+        for (const auto& stateMachine : entity.stateMachines)
+        {
+            // the state machines of configFile are replaced
+            if (otherFile != configFile &&
+                stateMachine->objPathCreated == config.objPath)
             {
-                errorState =
-                    "xyz.openbmc_project.State.InterfaceReady.States.Unknown";
-                manager.interfaceEntities.push_back(std::move(
-                    std::make_unique<
-                        configurable_state_manager::CategoryInterfaceReady>(
-                        *conn, objToBeAdded.c_str(), interfaceName, featureType,
-                        servicesToBeMonitored, stateProperty, defaultState,
-                        errorState, states)));
+                throw std::invalid_argument("Object " + config.objPath +
+                                            " is already used by " +
+                                            otherFile);
             }
-            else if (interfaceName.find("ServiceReady") != std::string::npos)
+        }
+    }
+}
+
+void ConfigurableStateManager::validateDependencies(
+    const std::string& configFile,
+    const std::vector<StateMachineConfig>& configs) const
+{
+    // the running state machines of the other json files, then configs
+    // replacing the ones of configFile
+    std::vector<std::string> objects;
+    std::vector<std::vector<std::string>> monitored;
+    for (const auto& [otherFile, entity] : entities)
+    {
+        if (otherFile == configFile)
+        {
+            continue;
+        }
+        for (const auto& stateMachine : entity.stateMachines)
+        {
+            objects.push_back(stateMachine->objPathCreated);
+            monitored.push_back(monitoredObjectPaths(stateMachine->program));
+        }
+    }
+    size_t firstNew = objects.size();
+    for (const StateMachineConfig& config : configs)
+    {
+        objects.push_back(config.objPath);
+        // csm objects are only monitored when listed explicitly
+        auto& objectPaths = monitored.emplace_back();
+        for (const auto& [intf, paths] : config.servicesToBeMonitored)
+        {
+            objectPaths.insert(objectPaths.end(), paths.begin(), paths.end());
+        }
+    }
+
+    // a cycle the running state machines already had is left to
+    // orderStateMachines(), only one configs closes rejects them
+    for (const auto& cycle :
+         orderDependencies(dependencyGraph(objects, monitored)).cycles)
+    {
+        if (cycle.back() < firstNew)
+        {
+            continue;
+        }
+        std::string members;
+        for (size_t node : cycle)
+        {
+            members += (members.empty() ? "" : ", ") + objects[node];
+        }
+        throw std::invalid_argument("Dependency cycle between " + members);
+    }
+}
+
+bool ConfigurableStateManager::createEntity(
+    const std::string& configFile, uint64_t contentHash,
+    const std::vector<StateMachineConfig>& configs)
+{
+    try
+    {
+        // the values the constructors set are checked up front, a rejected
+        // json leaves the running state machines of the file as they are
+        for (const StateMachineConfig& config : configs)
+        {
+            validateConfig(configFile, config);
+        }
+        validateDependencies(configFile, configs);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>(
+            (boost::format("State machines of %s rejected, [E]:%s") %
+             configFile % e.what())
+                .str()
+                .c_str());
+        return false;
+    }
+
+    // programs and states of the previous state machines by object path
+    std::map<std::string, RuleProgram> previous;
+    std::map<std::string, std::string> previousStates;
+    auto entity = entities.find(configFile);
+    if (entity != entities.end())
+    {
+        // the object paths may stay the same, the old objects have to go
+        // before the new ones are added
+        for (auto& stateMachine : entity->second.stateMachines)
+        {
+            previous.emplace(stateMachine->objPathCreated,
+                             std::move(stateMachine->program));
+            previousStates.emplace(stateMachine->objPathCreated,
+                                   stateMachine->reportedState);
+        }
+        entities.erase(entity);
+    }
+
+    Entity created{contentHash, {}};
+    for (const StateMachineConfig& config : configs)
+    {
+        auto stateMachine = createStateMachine(config);
+        auto program = previous.find(config.objPath);
+        if (program != previous.end())
+        {
+            // values of the objects still monitored need no new Get
+            stateMachine->program.adoptValues(program->second);
+        }
+        auto state = previousStates.find(config.objPath);
+        if (state != previousStates.end() &&
+            state->second != config.defaultState)
+        {
+            // provisional until its initial transition, the dependents do
+            // not see the default state in between
+            stateMachine->restoreState(state->second, "Reload");
+        }
+        created.stateMachines.push_back(std::move(stateMachine));
+    }
+    entities.emplace(configFile, std::move(created));
+    return true;
+}
+
+void ConfigurableStateManager::loadConfigFiles(
+    const std::vector<std::string>& configFiles)
+{
+    // the cache is keyed by everything it is built from
+    uint64_t hash = fnv1a(objPathRoot, fnv1a(configCacheVersion));
+    std::vector<std::string> contents;
+    for (const std::string& configFile : configFiles)
+    {
+        std::ifstream file(configFile, std::ios::binary);
+        std::string content{std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>()};
+        hash = fnv1a(configFile + '\0' + std::to_string(content.size()) + '\0',
+                     hash);
+        hash = fnv1a(content, hash);
+        contents.push_back(std::move(content));
+    }
+
+    if (auto cached = readConfigCache(hash))
+    {
+        for (CachedConfig& config : *cached)
+        {
+            auto rules = std::make_shared<const RuleSet>(config.states);
+            for (StateMachineConfig& stateMachineConfig : config.configs)
             {
-                errorState =
-                    "xyz.openbmc_project.State.ServiceReady.States.Unknown";
-                manager.serviceEntities.push_back(
-                    std::move(std::make_unique<
-                              configurable_state_manager::CategoryServiceReady>(
-                        *conn, objToBeAdded.c_str(), interfaceName, featureType,
-                        servicesToBeMonitored, stateProperty, defaultState,
-                        errorState, states)));
+                stateMachineConfig.rules = rules;
             }
-            else if (interfaceName.find("State.Chassis") != std::string::npos)
+            createEntity(config.configFile, config.contentHash,
+                         config.configs);
+        }
+        return;
+    }
+
+    std::vector<CachedConfig> cached;
+    for (size_t index = 0; index < configFiles.size(); ++index)
+    {
+        const std::string& configFile = configFiles[index];
+        Json data = Json::parse(contents[index], nullptr, false);
+        if (data.is_discarded())
+        {
+            log<level::ERR>("Corrupted Json file",
+                            entry("FILE_NAME=%s", configFile.c_str()));
+            continue;
+        }
+        try
+        {
+            CachedConfig config{configFile, fnv1a(contents[index]),
+                                parseStates(data), {}};
+            config.configs = parseStateMachines(
+                data, std::make_shared<const RuleSet>(config.states));
+            if (createEntity(configFile, config.contentHash, config.configs))
             {
-                errorState =
-                    "xyz.openbmc_project.State.Chassis.PowerState.Unknown";
-                manager.powerEntities.push_back(std::move(
-                    std::make_unique<
-                        configurable_state_manager::CategoryChassisPowerReady>(
-                        *conn, objToBeAdded.c_str(), interfaceName, featureType,
-                        servicesToBeMonitored, stateProperty, defaultState,
-                        errorState, states)));
+                cached.push_back(std::move(config));
             }
         }
-        catch (std::exception& e)
+        catch (const std::exception& e)
         {
-            auto errStrPath =
+            log<level::ERR>(
                 (boost::format("Corrupted Json file, Filename is:%s, [E]:%s") %
                  configFile % e.what())
-                    .str();
-            log<level::ERR>(errStrPath.c_str());
+                    .str()
+                    .c_str());
+        }
+    }
+    // the files failing to load fail again from the cache, they are part of
+    // the hash but not cached
+    writeConfigCache(hash, cached);
+}
 
-            // continue processing for next json file
-            continue;
+std::optional<std::vector<ConfigurableStateManager::CachedConfig>>
+    ConfigurableStateManager::readConfigCache(uint64_t hash)
+{
+    int fd = open(CUSTOM_CONFIG_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return std::nullopt;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return std::nullopt;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return std::nullopt;
+    }
+
+    std::optional<std::vector<CachedConfig>> cached;
+    try
+    {
+        // deserialized from the mapping, without reading the file into a
+        // buffer first
+        std::ispanstream is(
+            std::span<const char>(static_cast<const char*>(image), size));
+        cereal::BinaryInputArchive iarchive(is);
+        uint64_t imageHash = 0;
+        iarchive(imageHash);
+        if (imageHash == hash)
+        {
+            cached.emplace();
+            iarchive(*cached);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        // not only cereal::Exception, a corrupt length throws e.g.
+        // std::bad_alloc or std::length_error
+        log<level::ERR>(
+            (boost::format("Ignoring the config cache, [E]:%s") % e.what())
+                .str()
+                .c_str());
+        cached.reset();
+    }
+    munmap(image, size);
+    return cached;
+}
+
+void ConfigurableStateManager::writeConfigCache(
+    uint64_t hash, const std::vector<CachedConfig>& cached)
+{
+    fs::path path{CUSTOM_CONFIG_CACHE_PATH};
+    // written aside and renamed over the old image, a mapping of the old
+    // image never sees it truncated
+    fs::path tmpPath{path.string() + ".tmp"};
+    try
+    {
+        fs::create_directories(path.parent_path());
+        {
+            std::ofstream os(tmpPath.c_str(), std::ios::binary);
+            cereal::BinaryOutputArchive oarchive(os);
+            oarchive(hash, cached);
+        }
+        fs::rename(tmpPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>(
+            (boost::format("Failed to write the config cache %s, [E]:%s") %
+             path.string() % e.what())
+                .str()
+                .c_str());
+    }
+}
+
+void ConfigurableStateManager::orderStateMachines()
+{
+    // every state machine with the json file it comes from
+    std::vector<std::pair<std::string, StateMachineHandler*>> nodes;
+    std::vector<std::string> objects;
+    std::vector<std::vector<std::string>> monitored;
+    for (const auto& [configFile, entity] : entities)
+    {
+        for (const auto& stateMachine : entity.stateMachines)
+        {
+            nodes.emplace_back(configFile, stateMachine.get());
+            objects.push_back(stateMachine->objPathCreated);
+            monitored.push_back(monitoredObjectPaths(stateMachine->program));
+        }
+    }
+
+    // a state machine depends on the csm objects it monitors
+    auto dependencies = dependencyGraph(objects, monitored);
+    DependencyOrder order = orderDependencies(dependencies);
+    for (size_t rank = 0; rank < order.order.size(); ++rank)
+    {
+        nodes[order.order[rank]].second->rank = rank;
+    }
+    for (const auto& cycle : order.cycles)
+    {
+        // instances of a json in the cycle reject the whole json
+        std::set<std::string> configFiles;
+        for (size_t node : cycle)
+        {
+            configFiles.insert(nodes[node].first);
+        }
+        std::string files;
+        for (const std::string& configFile : configFiles)
+        {
+            files += (files.empty() ? "" : ", ") + configFile;
+        }
+        log<level::ERR>(
+            (boost::format(
+                 "Dependency cycle between the states of %s, rejecting them") %
+             files)
+                .str()
+                .c_str());
+        for (const std::string& configFile : configFiles)
+        {
+            entities.erase(configFile);
+        }
+    }
+}
+
+std::vector<StateMachineHandler*>
+    ConfigurableStateManager::rankedStateMachines() const
+{
+    std::vector<StateMachineHandler*> stateMachines;
+    for (const auto& [configFile, entity] : entities)
+    {
+        for (const auto& stateMachine : entity.stateMachines)
+        {
+            stateMachines.push_back(stateMachine.get());
+        }
+    }
+    std::sort(stateMachines.begin(), stateMachines.end(),
+              [](const StateMachineHandler* a, const StateMachineHandler* b) {
+        return a->rank < b->rank;
+    });
+    return stateMachines;
+}
+
+void ConfigurableStateManager::watchConfigDirectory()
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        log<level::ERR>("Unable to watch the config directory",
+                        entry("ERRNO=%d", errno));
+        return;
+    }
+    if (inotify_add_watch(fd, folderPath.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                              IN_DELETE) < 0)
+    {
+        log<level::ERR>("Unable to watch the config directory",
+                        entry("ERRNO=%d", errno),
+                        entry("PATH=%s", folderPath.c_str()));
+        close(fd);
+        return;
+    }
+    configWatch = std::make_unique<boost::asio::posix::stream_descriptor>(
+        conn->get_io_context(), fd);
+    readConfigEvents();
+}
+
+void ConfigurableStateManager::readConfigEvents()
+{
+    configWatch->async_read_some(
+        boost::asio::buffer(configEvents),
+        [this](const boost::system::error_code& ec, size_t size) {
+        if (ec)
+        {
+            log<level::ERR>("Stopped watching the config directory",
+                            entry("ERR=%s", ec.message().c_str()));
+            return;
+        }
+
+        // a file written several times is applied once
+        std::set<std::string> configFiles;
+        for (size_t offset = 0; offset + sizeof(inotify_event) <= size;)
+        {
+            inotify_event event;
+            std::memcpy(&event, configEvents.data() + offset, sizeof(event));
+            const char* name = configEvents.data() + offset + sizeof(event);
+            offset += sizeof(event) + event.len;
+
+            fs::path file = fs::path(folderPath) /
+                            std::string(name, strnlen(name, event.len));
+            if (event.len > 0 && file.extension() == ".json")
+            {
+                configFiles.insert(file.string());
+            }
+        }
+
+        // the dependents see the replaced state machines once they are all
+        // created and ranked, not each state they pass through meanwhile
+        StateRegistry::instance().hold();
+        std::vector<std::string> created;
+        for (const std::string& configFile : configFiles)
+        {
+            if (loadConfigFile(configFile))
+            {
+                created.push_back(configFile);
+            }
+        }
+        orderStateMachines();
+        sizeServiceCache();
+        StateRegistry::instance().release();
+        // a startup snapshot still outstanding must not reach the state
+        // machines dropped
+        if (auto stateMachines = snapshotStateMachines.lock())
+        {
+            *stateMachines = rankedStateMachines();
+        }
+
+        // initial transition of the new ones, in dependency order
+        std::set<StateMachineHandler*> pending;
+        for (const std::string& configFile : created)
+        {
+            // unless rejected for a dependency cycle
+            auto entity = entities.find(configFile);
+            if (entity == entities.end())
+            {
+                continue;
+            }
+            for (const auto& stateMachine : entity->second.stateMachines)
+            {
+                pending.insert(stateMachine.get());
+            }
+        }
+        for (StateMachineHandler* stateMachine : rankedStateMachines())
+        {
+            if (!pending.contains(stateMachine))
+            {
+                continue;
+            }
+            // right away unless it has path patterns to resolve first
+            stateMachine->resolvePathPatterns([stateMachine]() {
+                try
+                {
+                    stateMachine->executeTransition();
+                }
+                catch (const std::exception& e)
+                {
+                    log<level::ERR>(
+                        (boost::format("Initial transition of %s : [E]:%s") %
+                         stateMachine->objPathCreated % e.what())
+                            .str()
+                            .c_str());
+                }
+            });
+        }
+        readConfigEvents();
+    });
+}
+
+} // namespace configurable_state_manager
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Service Entry Point
+ */
+int main()
+{
+    log<level::INFO>("Creating Configurable State Manager connection");
+    auto io = std::make_shared<boost::asio::io_context>();
+    auto conn = std::make_shared<sdbusplus::asio::connection>(*io);
+
+    // For now, we only have one instance of the configurable state manager
+    auto objPathInst = std::string{CUSTOM_OBJPATH};
+
+    // Add sdbusplus ObjectManager.
+    sdbusplus::server::manager::manager objManager(*conn, objPathInst.c_str());
+    // csm specific interfaces, the ObjectManager above covers them
+    auto server = std::make_shared<sdbusplus::asio::object_server>(conn, true);
+    configurable_state_manager::ConfigurableStateManager manager(
+        conn, server, objPathInst, CUSTOM_FILEPATH);
+    conn->request_name(CUSTOM_BUSNAME);
+    // resolve each (path, interface) through the mapper only once
+    phosphor::state::manager::utils::ServiceCache::instance().watch(*conn);
+    // namespace wide signal subscriptions shared by all the state machines
+    configurable_state_manager::SignalDemux::instance().attach(*conn);
+    // GPIO lines and files the conditions look at
+    configurable_state_manager::LocalSources::instance().attach(*io);
+
+    std::set<std::string> builtinFiles;
+#ifdef CSM_BUILTIN_TABLES
+    // state machines generated at build time from the json files, these are
+    // not parsed again
+    builtinFiles = manager.loadBuiltinStateMachines(
+        configurable_state_manager::builtinStateMachines);
+#endif
+
+    // Folder path to JSON files
+    std::string folderPath = std::string{CUSTOM_FILEPATH};
+    std::vector<std::string> jsonFiles;
+    for (const auto& filePath : fs::directory_iterator(folderPath))
+    {
+        if (filePath.is_regular_file() &&
+            filePath.path().extension() == ".json" &&
+            !builtinFiles.contains(filePath.path().string()))
+        {
+            jsonFiles.push_back(filePath.path().string());
         }
     }
+
+    // Sort the JSON file paths alphabetically
+    std::sort(jsonFiles.begin(), jsonFiles.end());
+
+    // Process JSON files in alphabetical order, or their cached form
+    manager.loadConfigFiles(jsonFiles);
+    // csm states feeding each other are evaluated in dependency order
+    manager.orderStateMachines();
+    manager.sizeServiceCache();
+    // apply json files added, changed or removed from now on
+    manager.watchConfigDirectory();
+
+    // seed the caches and run the initial transitions once io is running
+    manager.loadSnapshot();
+
     // Start the Asio I/O service
     io->run();
     return 0;
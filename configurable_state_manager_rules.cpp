@@ -0,0 +1,1029 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2021-2024 NVIDIA CORPORATION &
+ * AFFILIATES. All rights reserved. SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "configurable_state_manager_rules.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <functional>
+#include <queue>
+#include <span>
+#include <stdexcept>
+
+namespace configurable_state_manager
+{
+
+LogicOp parseLogicOp(std::string_view logic)
+{
+    if (logic.empty())
+    {
+        return LogicOp::Single;
+    }
+    if (logic == "AND")
+    {
+        return LogicOp::And;
+    }
+    if (logic == "OR")
+    {
+        return LogicOp::Or;
+    }
+    if (logic == "AtLeast")
+    {
+        return LogicOp::AtLeast;
+    }
+    if (logic == "AtMost")
+    {
+        return LogicOp::AtMost;
+    }
+    throw std::invalid_argument("Unsupported logic gate used: " +
+                                std::string(logic));
+}
+
+ExpectedValue::ExpectedValue(const std::string& text) : text(text)
+{
+    int parsed = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                     parsed);
+    // only when the int prints back to the same text, e.g. not for "007"
+    if (ec == std::errc() && end == text.data() + text.size() &&
+        std::to_string(parsed) == text)
+    {
+        asInt = parsed;
+    }
+
+    if (text == "true")
+    {
+        asBool = true;
+    }
+    else if (text == "false")
+    {
+        asBool = false;
+    }
+}
+
+bool ExpectedValue::matches(const PropertyValue& value) const
+{
+    if (const auto* intValue = std::get_if<int>(&value))
+    {
+        return asInt && *asInt == *intValue;
+    }
+    if (const auto* boolValue = std::get_if<bool>(&value))
+    {
+        return asBool && *asBool == *boolValue;
+    }
+    return std::get<std::string>(value) == text;
+}
+
+RuleSet::RuleSet(const std::vector<State>& states)
+{
+    for (const State& state : states)
+    {
+        CompiledState compiled{state.name, parseLogicOp(state.logic),
+                               state.holdTime,
+                               static_cast<uint32_t>(compiledConditions.size()),
+                               0};
+        if (compiled.logic == LogicOp::AtLeast ||
+            compiled.logic == LogicOp::AtMost)
+        {
+            throw std::invalid_argument("Logic gate " + state.logic +
+                                        " is only supported for conditions");
+        }
+        for (const Condition& condition : state.conditions)
+        {
+            compiledConditions.push_back(CompiledCondition{
+                condition.intf, condition.property,
+                ExpectedValue(condition.value), parseLogicOp(condition.logic),
+                condition.count, condition.holdTime,
+                static_cast<uint32_t>(compiledStates.size())});
+        }
+        compiled.endCondition =
+            static_cast<uint32_t>(compiledConditions.size());
+        compiledStates.push_back(std::move(compiled));
+    }
+}
+
+std::string_view pathNamespace(std::string_view objectPath, size_t depth)
+{
+    size_t end = 0;
+    for (size_t component = 0; component < depth; ++component)
+    {
+        end = objectPath.find('/', end + 1);
+        if (end == std::string_view::npos)
+        {
+            return objectPath;
+        }
+    }
+    return objectPath.substr(0, end);
+}
+
+bool inPathNamespace(std::string_view objectPath, std::string_view ns)
+{
+    return objectPath.starts_with(ns) &&
+           (objectPath.size() == ns.size() || ns == "/" ||
+            objectPath[ns.size()] == '/');
+}
+
+namespace
+{
+
+std::vector<std::string_view> pathComponents(std::string_view objectPath)
+{
+    std::vector<std::string_view> components;
+    size_t begin = 0;
+    while (begin < objectPath.size())
+    {
+        size_t end = objectPath.find('/', begin);
+        if (end == std::string_view::npos)
+        {
+            end = objectPath.size();
+        }
+        if (end > begin)
+        {
+            components.push_back(objectPath.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return components;
+}
+
+bool matchComponent(std::string_view pattern, std::string_view name)
+{
+    // on a mismatch retry from the last '*', letting it take one more char
+    size_t p = 0;
+    size_t n = 0;
+    size_t star = std::string_view::npos;
+    size_t starName = 0;
+    while (n < name.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            starName = n;
+        }
+        else if (p < pattern.size() && pattern[p] == name[n])
+        {
+            ++p;
+            ++n;
+        }
+        else if (star != std::string_view::npos)
+        {
+            p = star + 1;
+            n = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+    {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+bool matchComponents(std::span<const std::string_view> pattern,
+                     std::span<const std::string_view> path)
+{
+    if (pattern.empty())
+    {
+        return path.empty();
+    }
+    if (pattern.front() == "**")
+    {
+        for (size_t skip = 0; skip <= path.size(); ++skip)
+        {
+            if (matchComponents(pattern.subspan(1), path.subspan(skip)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    return !path.empty() && matchComponent(pattern.front(), path.front()) &&
+           matchComponents(pattern.subspan(1), path.subspan(1));
+}
+
+} // namespace
+
+std::string unitObjectPath(std::string_view unit)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+    std::string objectPath = "/org/freedesktop/systemd1/unit/";
+    if (unit.empty())
+    {
+        return objectPath + "_";
+    }
+    for (size_t i = 0; i < unit.size(); ++i)
+    {
+        auto c = static_cast<unsigned char>(unit[i]);
+        bool letter = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+        bool digit = c >= '0' && c <= '9';
+        // anything else, and a leading digit, as _xx
+        if (letter || (digit && i > 0))
+        {
+            objectPath += static_cast<char>(c);
+        }
+        else
+        {
+            objectPath += '_';
+            objectPath += hex[c >> 4];
+            objectPath += hex[c & 0xf];
+        }
+    }
+    return objectPath;
+}
+
+bool isPathPattern(std::string_view objectPath)
+{
+    return objectPath.find('*') != std::string_view::npos;
+}
+
+bool matchPathPattern(std::string_view pattern, std::string_view objectPath)
+{
+    auto patternComponents = pathComponents(pattern);
+    auto components = pathComponents(objectPath);
+    return matchComponents(patternComponents, components);
+}
+
+std::string_view patternRoot(std::string_view pattern)
+{
+    size_t wildcard = pattern.find('*');
+    if (wildcard == std::string_view::npos)
+    {
+        return pattern;
+    }
+    size_t end = pattern.rfind('/', wildcard);
+    if (end == 0 || end == std::string_view::npos)
+    {
+        return "/";
+    }
+    return pattern.substr(0, end);
+}
+
+std::unordered_map<std::string, std::vector<std::string>> explicitObjects(
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored)
+{
+    std::unordered_map<std::string, std::vector<std::string>> objects;
+    for (const auto& [intf, objectPaths] : servicesToBeMonitored)
+    {
+        auto& explicitPaths = objects[intf];
+        for (const std::string& objectPath : objectPaths)
+        {
+            if (!isPathPattern(objectPath))
+            {
+                explicitPaths.push_back(objectPath);
+            }
+        }
+    }
+    return objects;
+}
+
+std::string expandPlaceholder(std::string_view text,
+                              std::string_view placeholder,
+                              std::string_view instance)
+{
+    std::string expanded;
+    size_t start = 0;
+    for (size_t found = text.find(placeholder);
+         !placeholder.empty() && found != std::string_view::npos;
+         found = text.find(placeholder, start))
+    {
+        expanded.append(text.substr(start, found - start));
+        expanded.append(instance);
+        start = found + placeholder.size();
+    }
+    expanded.append(text.substr(start));
+    return expanded;
+}
+
+std::vector<Instance> expandInstances(
+    std::string_view placeholder, std::string_view objectName,
+    const std::vector<std::string>& names,
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored,
+    const RuleSet& rules)
+{
+    if (placeholder.empty() ||
+        objectName.find(placeholder) == std::string_view::npos)
+    {
+        // the instances would share one object path
+        throw std::invalid_argument(
+            "Instances need their placeholder in ObjectName");
+    }
+    auto usesPlaceholder = [placeholder](std::string_view text) {
+        return text.find(placeholder) != std::string_view::npos;
+    };
+    bool shared = false;
+    for (const CompiledState& state : rules.states())
+    {
+        shared = shared || usesPlaceholder(state.name);
+    }
+    for (const CompiledCondition& condition : rules.conditions())
+    {
+        shared = shared || usesPlaceholder(condition.intf) ||
+                 usesPlaceholder(condition.property) ||
+                 usesPlaceholder(condition.expected.str());
+    }
+    if (shared)
+    {
+        throw std::invalid_argument(
+            "Instances share their States, which can not use the placeholder");
+    }
+
+    std::vector<Instance> instances;
+    for (const std::string& name : names)
+    {
+        Instance instance{expandPlaceholder(objectName, placeholder, name),
+                          {}};
+        // a dbus object path element
+        if (instance.objectName.empty() ||
+            !std::ranges::all_of(instance.objectName, [](char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+        }))
+        {
+            throw std::invalid_argument("Invalid object name " +
+                                        instance.objectName);
+        }
+        if (std::ranges::any_of(instances, [&](const Instance& other) {
+            return other.objectName == instance.objectName;
+        }))
+        {
+            throw std::invalid_argument("Instance " + name + " repeats");
+        }
+        for (const auto& [intf, objectPaths] : servicesToBeMonitored)
+        {
+            auto& expanded = instance.servicesToBeMonitored[intf];
+            for (const std::string& objectPath : objectPaths)
+            {
+                expanded.push_back(
+                    expandPlaceholder(objectPath, placeholder, name));
+            }
+        }
+        instances.push_back(std::move(instance));
+    }
+    return instances;
+}
+
+uint64_t fnv1a(std::string_view data, uint64_t hash)
+{
+    for (char c : data)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+void EvaluationMetrics::recordLatency(std::chrono::nanoseconds latency)
+{
+    auto us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency)
+            .count());
+    ++latencyHistogram[std::min<size_t>(std::bit_width(us),
+                                        latencyBuckets - 1)];
+}
+
+void TransitionHistory::record(TransitionRecord transition)
+{
+    if (ring.empty())
+    {
+        return;
+    }
+    ring[next] = std::move(transition);
+    next = (next + 1) % ring.size();
+    count = std::min(count + 1, ring.size());
+}
+
+std::vector<TransitionRecord> TransitionHistory::records() const
+{
+    std::vector<TransitionRecord> transitions;
+    if (count == 0)
+    {
+        return transitions;
+    }
+    transitions.reserve(count);
+    size_t first = (next + ring.size() - count) % ring.size();
+    for (size_t index = 0; index < count; ++index)
+    {
+        transitions.push_back(ring[(first + index) % ring.size()]);
+    }
+    return transitions;
+}
+
+namespace
+{
+
+// Tarjan's strongly connected components
+struct ComponentSearch
+{
+    const std::vector<std::vector<size_t>>& dependencies;
+    std::vector<size_t> index;
+    std::vector<size_t> lowLink;
+    std::vector<bool> onStack;
+    std::vector<size_t> stack;
+    size_t nextIndex = 0;
+    std::vector<std::vector<size_t>> components;
+
+    static constexpr size_t unvisited = static_cast<size_t>(-1);
+
+    explicit ComponentSearch(
+        const std::vector<std::vector<size_t>>& dependencies) :
+        dependencies(dependencies), index(dependencies.size(), unvisited),
+        lowLink(dependencies.size(), 0), onStack(dependencies.size(), false)
+    {
+        for (size_t node = 0; node < dependencies.size(); ++node)
+        {
+            if (index[node] == unvisited)
+            {
+                visit(node);
+            }
+        }
+    }
+
+    void visit(size_t node)
+    {
+        index[node] = lowLink[node] = nextIndex++;
+        stack.push_back(node);
+        onStack[node] = true;
+
+        for (size_t dependency : dependencies[node])
+        {
+            if (index[dependency] == unvisited)
+            {
+                visit(dependency);
+                lowLink[node] = std::min(lowLink[node], lowLink[dependency]);
+            }
+            else if (onStack[dependency])
+            {
+                lowLink[node] = std::min(lowLink[node], index[dependency]);
+            }
+        }
+
+        if (lowLink[node] == index[node])
+        {
+            std::vector<size_t> component;
+            size_t member = 0;
+            do
+            {
+                member = stack.back();
+                stack.pop_back();
+                onStack[member] = false;
+                component.push_back(member);
+            } while (member != node);
+            components.push_back(std::move(component));
+        }
+    }
+};
+
+} // namespace
+
+DependencyOrder
+    orderDependencies(const std::vector<std::vector<size_t>>& dependencies)
+{
+    DependencyOrder result;
+    std::vector<bool> inCycle(dependencies.size(), false);
+    for (auto& component : ComponentSearch(dependencies).components)
+    {
+        size_t node = component.front();
+        bool selfLoop = std::find(dependencies[node].begin(),
+                                  dependencies[node].end(),
+                                  node) != dependencies[node].end();
+        if (component.size() > 1 || selfLoop)
+        {
+            std::sort(component.begin(), component.end());
+            for (size_t member : component)
+            {
+                inCycle[member] = true;
+            }
+            result.cycles.push_back(std::move(component));
+        }
+    }
+    std::sort(result.cycles.begin(), result.cycles.end());
+
+    // Kahn, lowest index first among the nodes ready
+    std::vector<size_t> pending(dependencies.size(), 0);
+    std::vector<std::vector<size_t>> dependents(dependencies.size());
+    for (size_t node = 0; node < dependencies.size(); ++node)
+    {
+        if (inCycle[node])
+        {
+            continue;
+        }
+        for (size_t dependency : dependencies[node])
+        {
+            // what depends on a cycle is ordered as if it did not
+            if (!inCycle[dependency])
+            {
+                ++pending[node];
+                dependents[dependency].push_back(node);
+            }
+        }
+    }
+
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<>> ready;
+    for (size_t node = 0; node < dependencies.size(); ++node)
+    {
+        if (!inCycle[node] && pending[node] == 0)
+        {
+            ready.push(node);
+        }
+    }
+    while (!ready.empty())
+    {
+        size_t node = ready.top();
+        ready.pop();
+        result.order.push_back(node);
+        for (size_t dependent : dependents[node])
+        {
+            if (--pending[dependent] == 0)
+            {
+                ready.push(dependent);
+            }
+        }
+    }
+    return result;
+}
+
+RuleProgram::RuleProgram(
+    std::shared_ptr<const RuleSet> rules,
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored) :
+    rules(std::move(rules))
+{
+    const auto& conditions = this->rules->conditions();
+    conditionSlotBegin.reserve(conditions.size() + 1);
+    // condition + 1 which last took each slot, an object listed twice for
+    // an interface counts once
+    std::vector<uint32_t> lastCondition;
+    for (size_t index = 0; index < conditions.size(); ++index)
+    {
+        const CompiledCondition& condition = conditions[index];
+        conditionSlotBegin.push_back(
+            static_cast<uint32_t>(conditionSlots.size()));
+
+        auto objectPaths = servicesToBeMonitored.find(condition.intf);
+        if (objectPaths == servicesToBeMonitored.end())
+        {
+            continue;
+        }
+        for (const std::string& objectPath : objectPaths->second)
+        {
+            auto [it, inserted] = slotIndex.try_emplace(
+                std::make_tuple(objectPath, condition.intf,
+                                condition.property),
+                slots.size());
+            if (inserted)
+            {
+                slots.push_back(
+                    SlotKey{objectPath, condition.intf, condition.property});
+                lastCondition.push_back(0);
+            }
+            if (lastCondition[it->second] == index + 1)
+            {
+                continue;
+            }
+            lastCondition[it->second] = static_cast<uint32_t>(index + 1);
+            conditionSlots.push_back(static_cast<uint32_t>(it->second));
+        }
+    }
+    conditionSlotBegin.push_back(static_cast<uint32_t>(conditionSlots.size()));
+
+    // reverse index, slot -> conditions using it
+    slotConditionBegin.assign(slots.size() + 1, 0);
+    for (uint32_t slot : conditionSlots)
+    {
+        ++slotConditionBegin[slot + 1];
+    }
+    for (size_t slot = 0; slot < slots.size(); ++slot)
+    {
+        slotConditionBegin[slot + 1] += slotConditionBegin[slot];
+    }
+    slotConditions.resize(conditionSlots.size());
+    std::vector<uint32_t> fill(slotConditionBegin.begin(),
+                               slotConditionBegin.end() - 1);
+    for (size_t condition = 0; condition < conditions.size(); ++condition)
+    {
+        for (uint32_t i = conditionSlotBegin[condition];
+             i < conditionSlotBegin[condition + 1]; ++i)
+        {
+            slotConditions[fill[conditionSlots[i]]++] =
+                static_cast<uint32_t>(condition);
+        }
+    }
+
+    values.resize(slots.size());
+    known.resize(slots.size(), false);
+    matchCounts.resize(conditions.size(), 0);
+    // no value is known yet
+    unknownCounts.resize(conditions.size(), 0);
+    undecidedConditions.resize(this->rules->states().size(), 0);
+    for (size_t condition = 0; condition < conditions.size(); ++condition)
+    {
+        unknownCounts[condition] = conditionSlotBegin[condition + 1] -
+                                   conditionSlotBegin[condition];
+        if (unknownCounts[condition] > 0)
+        {
+            ++undecidedConditions[conditions[condition].state];
+        }
+    }
+    conditionRaw.resize(conditions.size(), false);
+    conditionHeld.resize(conditions.size(), false);
+    conditionResults.resize(conditions.size(), false);
+    stateRaw.resize(this->rules->states().size(), false);
+    stateHeld.resize(this->rules->states().size(), false);
+    stateResults.resize(this->rules->states().size(), false);
+    startedHolds.reserve(holdCount());
+    stoppedHolds.reserve(holdCount());
+
+    // everything is checked on the first evaluation
+    conditionDirty.resize(conditions.size(), false);
+    stateDirty.resize(this->rules->states().size(), false);
+    dirtyConditions.reserve(conditions.size());
+    dirtyStates.reserve(this->rules->states().size());
+    for (size_t condition = 0; condition < conditions.size(); ++condition)
+    {
+        markConditionDirty(condition);
+    }
+    for (size_t state = 0; state < stateDirty.size(); ++state)
+    {
+        // states without conditions are not reached through a condition
+        stateDirty[state] = true;
+        dirtyStates.push_back(static_cast<uint32_t>(state));
+    }
+}
+
+void RuleProgram::markConditionDirty(size_t condition)
+{
+    if (!conditionDirty[condition])
+    {
+        conditionDirty[condition] = true;
+        dirtyConditions.push_back(static_cast<uint32_t>(condition));
+    }
+}
+
+void RuleProgram::markStateDirty(size_t state)
+{
+    if (!stateDirty[state])
+    {
+        stateDirty[state] = true;
+        dirtyStates.push_back(static_cast<uint32_t>(state));
+    }
+}
+
+std::chrono::milliseconds RuleProgram::holdTime(size_t hold) const
+{
+    const auto& conditions = rules->conditions();
+    if (hold < conditions.size())
+    {
+        return conditions[hold].holdTime;
+    }
+    return rules->states()[hold - conditions.size()].holdTime;
+}
+
+bool RuleProgram::updateHold(size_t hold, bool raw)
+{
+    bool isCondition = hold < conditionRaw.size();
+    size_t index = isCondition ? hold : hold - conditionRaw.size();
+    auto& raws = isCondition ? conditionRaw : stateRaw;
+    auto& held = isCondition ? conditionHeld : stateHeld;
+    bool timed = holdTime(hold).count() > 0;
+
+    if (raws[index] != raw)
+    {
+        // the hold starts over on every change
+        raws[index] = raw;
+        held[index] = false;
+        if (timed)
+        {
+            (raw ? startedHolds : stoppedHolds)
+                .push_back(static_cast<uint32_t>(hold));
+        }
+    }
+    return raw && (!timed || held[index]);
+}
+
+void RuleProgram::holdElapsed(size_t hold)
+{
+    if (hold < conditionRaw.size())
+    {
+        if (conditionRaw[hold] && !conditionHeld[hold])
+        {
+            conditionHeld[hold] = true;
+            conditionResults[hold] = true;
+            markStateDirty(rules->conditions()[hold].state);
+        }
+        return;
+    }
+
+    size_t state = hold - conditionRaw.size();
+    if (stateRaw[state] && !stateHeld[state])
+    {
+        stateHeld[state] = true;
+        stateResults[state] = true;
+    }
+}
+
+std::optional<size_t> RuleProgram::findSlot(std::string_view objectPath,
+                                            std::string_view intf,
+                                            std::string_view property) const
+{
+    auto it = slotIndex.find(std::make_tuple(objectPath, intf, property));
+    if (it == slotIndex.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+bool RuleProgram::setValue(size_t index, const PropertyValue& value)
+{
+    if (known[index] && values[index] == value)
+    {
+        return false;
+    }
+
+    const auto& conditions = rules->conditions();
+    for (uint32_t i = slotConditionBegin[index];
+         i < slotConditionBegin[index + 1]; ++i)
+    {
+        uint32_t condition = slotConditions[i];
+        const ExpectedValue& expected = conditions[condition].expected;
+        bool matched = known[index] && expected.matches(values[index]);
+        bool matches = expected.matches(value);
+        if (matches && !matched)
+        {
+            ++matchCounts[condition];
+        }
+        else if (matched && !matches)
+        {
+            --matchCounts[condition];
+        }
+        if (!known[index] && --unknownCounts[condition] == 0)
+        {
+            --undecidedConditions[conditions[condition].state];
+        }
+        markConditionDirty(condition);
+    }
+    values[index] = value;
+    known[index] = true;
+    return true;
+}
+
+void RuleProgram::clearValue(size_t index)
+{
+    if (!known[index])
+    {
+        return;
+    }
+
+    // only known values are counted
+    const auto& conditions = rules->conditions();
+    for (uint32_t i = slotConditionBegin[index];
+         i < slotConditionBegin[index + 1]; ++i)
+    {
+        uint32_t condition = slotConditions[i];
+        if (conditions[condition].expected.matches(values[index]))
+        {
+            --matchCounts[condition];
+            markConditionDirty(condition);
+        }
+        if (unknownCounts[condition]++ == 0)
+        {
+            ++undecidedConditions[conditions[condition].state];
+        }
+    }
+    known[index] = false;
+}
+
+bool RuleProgram::clearValues(std::string_view objectPath,
+                              std::string_view intf)
+{
+    bool cleared = false;
+    // the slots of an object and interface are next to each other
+    for (auto it = slotIndex.lower_bound(
+             std::make_tuple(objectPath, intf, std::string_view{}));
+         it != slotIndex.end() && std::get<0>(it->first) == objectPath &&
+         std::get<1>(it->first) == intf;
+         ++it)
+    {
+        cleared = cleared || known[it->second];
+        clearValue(it->second);
+    }
+    return cleared;
+}
+
+void RuleProgram::adoptValues(const RuleProgram& previous)
+{
+    for (size_t index = 0; index < slots.size(); ++index)
+    {
+        const SlotKey& key = slots[index];
+        auto slot = previous.findSlot(key.objectPath, key.intf, key.property);
+        if (slot && previous.hasValue(*slot))
+        {
+            setValue(index, previous.value(*slot));
+        }
+    }
+}
+
+bool RuleProgram::complete() const
+{
+    for (bool isKnown : known)
+    {
+        if (!isKnown)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RuleProgram::evaluateCondition(size_t condition) const
+{
+    const CompiledCondition& compiled = rules->conditions()[condition];
+    uint32_t begin = conditionSlotBegin[condition];
+    uint32_t objects = conditionSlotBegin[condition + 1] - begin;
+    uint32_t matching = matchCounts[condition];
+
+    switch (compiled.logic)
+    {
+        case LogicOp::Single:
+            // if no logic is present means only single entry
+            return objects > 0 &&
+                   compiled.expected.matches(values[conditionSlots[begin]]);
+        case LogicOp::And:
+            // not over no object, e.g. a path pattern matching none yet
+            return objects > 0 && matching == objects;
+        case LogicOp::Or:
+            return matching > 0;
+        case LogicOp::AtLeast:
+            return matching >= compiled.count;
+        case LogicOp::AtMost:
+            return matching <= compiled.count;
+    }
+    return false;
+}
+
+bool RuleProgram::evaluateState(size_t state) const
+{
+    const CompiledState& compiled = rules->states()[state];
+    if (compiled.firstCondition == compiled.endCondition)
+    {
+        // AND over no conditions holds, anything else does not
+        return compiled.logic == LogicOp::And;
+    }
+
+    switch (compiled.logic)
+    {
+        case LogicOp::Single:
+            // if no logic is present means only one condition was there
+            return conditionResults[compiled.firstCondition];
+        case LogicOp::And:
+            for (size_t condition = compiled.firstCondition;
+                 condition < compiled.endCondition; ++condition)
+            {
+                if (!conditionResults[condition])
+                {
+                    return false;
+                }
+            }
+            return true;
+        case LogicOp::Or:
+            for (size_t condition = compiled.firstCondition;
+                 condition < compiled.endCondition; ++condition)
+            {
+                if (conditionResults[condition])
+                {
+                    return true;
+                }
+            }
+            return false;
+        case LogicOp::AtLeast:
+        case LogicOp::AtMost:
+            // rejected for states by RuleSet
+            return false;
+    }
+    return false;
+}
+
+bool RuleProgram::stateDecided(size_t state) const
+{
+    if (undecidedConditions[state] == 0)
+    {
+        return true;
+    }
+
+    const CompiledState& compiled = rules->states()[state];
+    auto knownResult = [this](size_t condition, bool result) {
+        return unknownCounts[condition] == 0 &&
+               conditionResults[condition] == result;
+    };
+    switch (compiled.logic)
+    {
+        case LogicOp::And:
+            for (size_t condition = compiled.firstCondition;
+                 condition < compiled.endCondition; ++condition)
+            {
+                if (knownResult(condition, false))
+                {
+                    return true;
+                }
+            }
+            return false;
+        case LogicOp::Or:
+            for (size_t condition = compiled.firstCondition;
+                 condition < compiled.endCondition; ++condition)
+            {
+                if (knownResult(condition, true))
+                {
+                    return true;
+                }
+            }
+            return false;
+        case LogicOp::Single:
+        case LogicOp::AtLeast:
+        case LogicOp::AtMost:
+            // only the first condition is looked at
+            return unknownCounts[compiled.firstCondition] == 0;
+    }
+    return false;
+}
+
+std::optional<size_t> RuleProgram::evaluate()
+{
+    const auto& conditions = rules->conditions();
+
+    startedHolds.clear();
+    stoppedHolds.clear();
+
+    // re-check only the conditions whose slots changed, the ones missing a
+    // value stay marked until it is there
+    size_t waiting = 0;
+    for (uint32_t condition : dirtyConditions)
+    {
+        if (unknownCounts[condition] > 0)
+        {
+            dirtyConditions[waiting++] = condition;
+            continue;
+        }
+        conditionDirty[condition] = false;
+        ++conditionEvaluationCount;
+        bool result = updateHold(condition, evaluateCondition(condition));
+        if (result != conditionResults[condition])
+        {
+            conditionResults[condition] = result;
+            markStateDirty(conditions[condition].state);
+        }
+    }
+    dirtyConditions.resize(waiting);
+
+    // and only the states where one of those changed its result
+    waiting = 0;
+    for (uint32_t state : dirtyStates)
+    {
+        if (!stateDecided(state))
+        {
+            dirtyStates[waiting++] = state;
+            continue;
+        }
+        stateDirty[state] = false;
+        stateResults[state] = updateHold(conditions.size() + state,
+                                         evaluateState(state));
+    }
+    dirtyStates.resize(waiting);
+
+    // first state value whose conditions are met wins, unless a state
+    // before it is still waiting for a value
+    lastDecided = true;
+    for (size_t state = 0; state < stateResults.size(); ++state)
+    {
+        if (!stateDecided(state))
+        {
+            lastDecided = false;
+            return std::nullopt;
+        }
+        if (stateResults[state])
+        {
+            return state;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace configurable_state_manager
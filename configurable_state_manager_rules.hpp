@@ -0,0 +1,492 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2021-2024 NVIDIA CORPORATION &
+ * AFFILIATES. All rights reserved. SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace configurable_state_manager
+{
+
+// same alternatives as phosphor::state::manager::utils::PropertyValue
+using PropertyValue = std::variant<int, std::string, bool>;
+
+// Define a structure for conditions
+struct Condition
+{
+    std::string intf;
+    std::string property;
+    std::string value;
+    std::string logic;
+    // threshold of the AtLeast/AtMost logic gates
+    uint32_t count = 0;
+    // how long the condition has to hold before it counts as true
+    std::chrono::milliseconds holdTime{0};
+};
+
+// Define a structure for states
+struct State
+{
+    std::string name;
+    std::vector<Condition> conditions;
+    std::string logic;
+    // how long the conditions have to hold before the state is reached
+    std::chrono::milliseconds holdTime{0};
+};
+
+/** @brief Logic gate combining the objects of a condition or the conditions
+ *         of a state */
+enum class LogicOp : uint8_t
+{
+    Single, // no "Logic" given, only the first entry is looked at
+    And,
+    Or,
+    AtLeast, // at least "Count" objects match, conditions only
+    AtMost,  // no more than "Count" objects match, conditions only
+};
+
+/** @brief Convert the "Logic" string of the json, throws
+ *         std::invalid_argument on unsupported logic gates */
+LogicOp parseLogicOp(std::string_view logic);
+
+/** @brief Expected value of a condition pre-parsed for each alternative of
+ *         PropertyValue so that matching needs no conversion */
+class ExpectedValue
+{
+  public:
+    explicit ExpectedValue(const std::string& text);
+
+    /** @brief Whether value equals the expected one, an int or bool matches
+     *         when its string form is the expected text */
+    bool matches(const PropertyValue& value) const;
+
+    const std::string& str() const
+    {
+        return text;
+    }
+
+  private:
+    std::string text;
+    std::optional<int> asInt;
+    std::optional<bool> asBool;
+};
+
+struct CompiledCondition
+{
+    std::string intf;
+    std::string property;
+    ExpectedValue expected;
+    LogicOp logic;
+    // threshold of AtLeast/AtMost
+    uint32_t count;
+    std::chrono::milliseconds holdTime;
+    // index of the state the condition belongs to
+    uint32_t state;
+};
+
+struct CompiledState
+{
+    std::string name;
+    LogicOp logic;
+    std::chrono::milliseconds holdTime;
+    // conditions of the state are [firstCondition, endCondition) of RuleSet
+    uint32_t firstCondition;
+    uint32_t endCondition;
+};
+
+/** @class RuleSet
+ *  @brief Immutable compiled form of the "States" block of a json
+ */
+class RuleSet
+{
+  public:
+    /** @brief Compile the states, throws std::invalid_argument when a logic
+     *         gate is not supported, or not at the level it is used at */
+    explicit RuleSet(const std::vector<State>& states);
+
+    const std::vector<CompiledState>& states() const
+    {
+        return compiledStates;
+    }
+
+    const std::vector<CompiledCondition>& conditions() const
+    {
+        return compiledConditions;
+    }
+
+  private:
+    std::vector<CompiledState> compiledStates;
+    std::vector<CompiledCondition> compiledConditions;
+};
+
+/** @brief First depth components of an object path, e.g.
+ *         "/xyz/openbmc_project/state" for depth 3, the whole path when it
+ *         has fewer components */
+std::string_view pathNamespace(std::string_view objectPath, size_t depth);
+
+/** @brief Whether objectPath is the namespace itself or below it */
+bool inPathNamespace(std::string_view objectPath, std::string_view ns);
+
+/** @brief Object path of a systemd unit, its name encoded as
+ *         sd_bus_path_encode() does */
+std::string unitObjectPath(std::string_view unit);
+
+/** @brief Whether an object path of ServicesToBeMonitored is a pattern,
+ *         i.e. one of its components has a '*' */
+bool isPathPattern(std::string_view objectPath);
+
+/** @brief Whether objectPath matches pattern. Within a component '*' matches
+ *         any characters, a "**" component matches any number of components
+ *         including none. */
+bool matchPathPattern(std::string_view pattern, std::string_view objectPath);
+
+/** @brief Components of pattern before its first wildcard, i.e. the subtree
+ *         all the objects it matches are in */
+std::string_view patternRoot(std::string_view pattern);
+
+/** @brief ServicesToBeMonitored without its path patterns */
+std::unordered_map<std::string, std::vector<std::string>> explicitObjects(
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored);
+
+/** @brief text with every occurrence of placeholder replaced by instance,
+ *         used to expand the "Instances" of a templated json */
+std::string expandPlaceholder(std::string_view text,
+                              std::string_view placeholder,
+                              std::string_view instance);
+
+/** @brief A state machine of a json with "Instances", as expanded for one of
+ *         the names */
+struct Instance
+{
+    // its "ObjectName", the object below the root path it is hosted at
+    std::string objectName;
+    std::unordered_map<std::string, std::vector<std::string>>
+        servicesToBeMonitored;
+};
+
+/** @brief Expand the "Instances" of a templated json, the placeholder is
+ *         replaced by each name in objectName and the object paths of
+ *         servicesToBeMonitored. Throws std::invalid_argument when the
+ *         instances would not get an object each, i.e. objectName lacks the
+ *         placeholder, a name repeats or the object name is not a valid
+ *         path element, or when the rules all the instances share use the
+ *         placeholder. */
+std::vector<Instance> expandInstances(
+    std::string_view placeholder, std::string_view objectName,
+    const std::vector<std::string>& names,
+    const std::unordered_map<std::string, std::vector<std::string>>&
+        servicesToBeMonitored,
+    const RuleSet& rules);
+
+constexpr uint64_t fnv1aOffsetBasis = 0xcbf29ce484222325;
+
+/** @brief 64 bit FNV-1a hash of data, continuing from hash. Unlike std::hash
+ *         it is the same across builds, so that it can key data on disk. */
+uint64_t fnv1a(std::string_view data, uint64_t hash = fnv1aOffsetBasis);
+
+/** @brief Evaluation order of state machines depending on each other */
+struct DependencyOrder
+{
+    // nodes not in a cycle, each after all the nodes it depends on
+    std::vector<size_t> order;
+    // nodes depending on each other in a loop, in ascending order
+    std::vector<std::vector<size_t>> cycles;
+};
+
+/** @brief Order the nodes of a dependency graph
+ *  @param[in] dependencies - for each node the nodes it depends on
+ *  Nodes which do not depend on each other keep their index order.
+ */
+DependencyOrder
+    orderDependencies(const std::vector<std::vector<size_t>>& dependencies);
+
+/** @brief Counters of the evaluations of a state machine, kept as plain
+ *         integers so that recording costs next to nothing and read only
+ *         when asked for */
+struct EvaluationMetrics
+{
+    // latency bucket i counts rounds below 2^i microseconds which did not
+    // fit a previous bucket, the last one, from about 4 s, everything above
+    static constexpr size_t latencyBuckets = 24;
+
+    uint64_t evaluations = 0;
+    // changes of the state reported, fallbacks to the default included
+    uint64_t transitions = 0;
+    // bus calls issued for the state machine, retries included, a call
+    // made for several state machines counts for each of them
+    uint64_t dbusCalls = 0;
+    // evaluations which could not fetch all the values they needed
+    uint64_t fetchErrors = 0;
+    // times the default state was set for lack of a good state
+    uint64_t defaultFallbacks = 0;
+    std::array<uint64_t, latencyBuckets> latencyHistogram{};
+
+    void recordLatency(std::chrono::nanoseconds latency);
+
+    /** @brief Exclusive upper bound of a latency bucket in microseconds, the
+     *         last bucket has none */
+    static uint64_t latencyBucketBound(size_t bucket)
+    {
+        return uint64_t(1) << bucket;
+    }
+};
+
+/** @brief A change of the state reported by a state machine */
+struct TransitionRecord
+{
+    // milliseconds since epoch
+    uint64_t timestamp = 0;
+    std::string oldState;
+    std::string newState;
+    // what made the state machine evaluate, e.g. the object whose
+    // properties changed
+    std::string trigger;
+};
+
+/** @class TransitionHistory
+ *  @brief The last transitions of a state machine in a ring buffer of fixed
+ *         capacity, the oldest one is overwritten once it is full
+ */
+class TransitionHistory
+{
+  public:
+    explicit TransitionHistory(size_t capacity) : ring(capacity) {}
+
+    size_t capacity() const
+    {
+        return ring.size();
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    void record(TransitionRecord transition);
+
+    /** @brief The transitions kept, oldest first */
+    std::vector<TransitionRecord> records() const;
+
+  private:
+    std::vector<TransitionRecord> ring;
+    // slot the next transition is written to
+    size_t next = 0;
+    size_t count = 0;
+};
+
+/** @brief One monitored (objectPath, interface, property) combination */
+struct SlotKey
+{
+    std::string objectPath;
+    std::string intf;
+    std::string property;
+};
+
+/** @class RuleProgram
+ *  @brief A RuleSet bound to the object paths of ServicesToBeMonitored
+ *
+ *  Every distinct (objectPath, interface, property) used by the conditions
+ *  gets a slot holding its last known value. A reverse index from each slot
+ *  to the conditions using it lets a value change mark only those
+ *  conditions, and their states, for re-evaluation. Each condition counts
+ *  the objects whose value matches, updated by one on every value change,
+ *  so that it is re-checked in constant time whatever its number of
+ *  objects. Evaluation does not allocate.
+ *
+ *  A condition is only checked once all its slots have a value. The states
+ *  its result is needed for wait for it, the others are decided from the
+ *  values known, so that a value still being fetched does not hold up the
+ *  evaluation of the conditions which do not use it.
+ *
+ *  A condition or state with a hold time only becomes true once its result
+ *  stayed true for that long. The program does not keep time, each hold is
+ *  reported as started or stopped by evaluate() and the caller reports back
+ *  when its time ran out with holdElapsed().
+ */
+class RuleProgram
+{
+  public:
+    RuleProgram(std::shared_ptr<const RuleSet> rules,
+                const std::unordered_map<std::string, std::vector<std::string>>&
+                    servicesToBeMonitored);
+
+    const RuleSet& ruleSet() const
+    {
+        return *rules;
+    }
+
+    const std::shared_ptr<const RuleSet>& sharedRuleSet() const
+    {
+        return rules;
+    }
+
+    size_t slotCount() const
+    {
+        return slots.size();
+    }
+
+    const SlotKey& slot(size_t index) const
+    {
+        return slots[index];
+    }
+
+    /** @brief Slot of the combination if any condition uses it */
+    std::optional<size_t> findSlot(std::string_view objectPath,
+                                   std::string_view intf,
+                                   std::string_view property) const;
+
+    bool hasValue(size_t index) const
+    {
+        return known[index];
+    }
+
+    const PropertyValue& value(size_t index) const
+    {
+        return values[index];
+    }
+
+    /** @brief Store the value of a slot, the conditions using it are
+     *         re-checked on next evaluation if the value changed
+     *  @return whether the value changed */
+    bool setValue(size_t index, const PropertyValue& value);
+    void clearValue(size_t index);
+
+    /** @brief Clear the values of every property of intf on objectPath,
+     *         e.g. once the object left the bus
+     *  @return whether any of them was known */
+    bool clearValues(std::string_view objectPath, std::string_view intf);
+
+    /** @brief Take over the known values of the slots previous has as
+     *         well, used when the rules of a state machine are replaced */
+    void adoptValues(const RuleProgram& previous);
+
+    /** @brief Whether every slot has a value */
+    bool complete() const;
+
+    /** @brief Index of the first state whose conditions hold, std::nullopt
+     *         when none does. Only the conditions whose slots changed since
+     *         the last call and the states owning them are re-checked. The
+     *         conditions missing a value are left for a later call. */
+    std::optional<size_t> evaluate();
+
+    /** @brief Whether the result of the last evaluate() holds, false when a
+     *         state before the one returned, or any state when none was,
+     *         depends on a condition missing a value */
+    bool decided() const
+    {
+        return lastDecided;
+    }
+
+    /** @brief Holds are numbered by condition index, followed by the states
+     *         offset by the number of conditions */
+    size_t holdCount() const
+    {
+        return conditionHeld.size() + stateHeld.size();
+    }
+
+    std::chrono::milliseconds holdTime(size_t hold) const;
+
+    /** @brief Holds whose result turned true on the last evaluate(), a timer
+     *         of holdTime() is to be started for each */
+    const std::vector<uint32_t>& holdsStarted() const
+    {
+        return startedHolds;
+    }
+
+    /** @brief Holds whose result turned false on the last evaluate(), their
+     *         timer is to be cancelled */
+    const std::vector<uint32_t>& holdsStopped() const
+    {
+        return stoppedHolds;
+    }
+
+    /** @brief The hold time of hold ran out, it counts as true on next
+     *         evaluation if its result did not change meanwhile */
+    void holdElapsed(size_t hold);
+
+    /** @brief Number of condition checks done by evaluate() so far */
+    uint64_t conditionEvaluations() const
+    {
+        return conditionEvaluationCount;
+    }
+
+  private:
+    bool evaluateCondition(size_t condition) const;
+    bool evaluateState(size_t state) const;
+    /** @brief Whether the result of state does not depend on a condition
+     *         missing a value, e.g. an AND with a condition known false */
+    bool stateDecided(size_t state) const;
+    void markConditionDirty(size_t condition);
+    void markStateDirty(size_t state);
+    /** @brief Record the result of hold without its hold time, return the
+     *         result with the hold time applied */
+    bool updateHold(size_t hold, bool raw);
+
+    std::shared_ptr<const RuleSet> rules;
+    std::vector<SlotKey> slots;
+    std::map<std::tuple<std::string, std::string, std::string>, size_t,
+             std::less<>>
+        slotIndex;
+    std::vector<PropertyValue> values;
+    std::vector<bool> known;
+    // slots of condition i are [conditionSlotBegin[i], conditionSlotBegin[i+1])
+    // of conditionSlots
+    std::vector<uint32_t> conditionSlotBegin;
+    std::vector<uint32_t> conditionSlots;
+    // conditions using slot i are [slotConditionBegin[i],
+    // slotConditionBegin[i+1]) of slotConditions
+    std::vector<uint32_t> slotConditionBegin;
+    std::vector<uint32_t> slotConditions;
+    // slots of each condition whose known value matches its expected one
+    std::vector<uint32_t> matchCounts;
+    // slots of each condition without a value, it is only checked once
+    // there are none
+    std::vector<uint32_t> unknownCounts;
+    // conditions of each state with slots without a value
+    std::vector<uint32_t> undecidedConditions;
+    bool lastDecided = false;
+    // result of the last evaluation of each condition and state, without
+    // and with their hold time applied
+    std::vector<bool> conditionRaw;
+    std::vector<bool> conditionHeld;
+    std::vector<bool> conditionResults;
+    std::vector<bool> stateRaw;
+    std::vector<bool> stateHeld;
+    std::vector<bool> stateResults;
+    std::vector<uint32_t> startedHolds;
+    std::vector<uint32_t> stoppedHolds;
+    // conditions and states to re-check, reserved for all of them at
+    // construction so that marking never allocates
+    std::vector<bool> conditionDirty;
+    std::vector<bool> stateDirty;
+    std::vector<uint32_t> dirtyConditions;
+    std::vector<uint32_t> dirtyStates;
+    uint64_t conditionEvaluationCount = 0;
+};
+
+} // namespace configurable_state_manager
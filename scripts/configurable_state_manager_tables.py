@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# SPDX-FileCopyrightText: Copyright (c) 2021-2024 NVIDIA CORPORATION &
+# AFFILIATES. All rights reserved. SPDX-License-Identifier: Apache-2.0
+#
+# Generate the constexpr tables of the configurable state manager from the
+# json files of a directory, so that a fixed set of state machines needs no
+# json parsing at startup. The tables are described in
+# configurable_state_manager_builtin.hpp.
+#
+# usage: configurable_state_manager_tables.py <json dir> <output> <depfile>
+
+import json
+import os
+import re
+import sys
+
+
+def literal(text):
+    # json string escapes are valid C++ ones
+    return json.dumps(text)
+
+
+def value_text(value):
+    # as nlohmann::json::dump() writes a non string value
+    if isinstance(value, str):
+        return value
+    return json.dumps(value, separators=(",", ":"))
+
+
+def fnv1a(data):
+    # as fnv1a() of configurable_state_manager_rules.hpp
+    value = 0xCBF29CE484222325
+    for byte in data:
+        value ^= byte
+        value = (value * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    return value
+
+
+class Generator:
+    def __init__(self):
+        self.lines = []
+
+    def array(self, name, type_, entries):
+        self.lines.append(
+            "inline constexpr std::array<{}, {}> {}{{{{".format(
+                type_, len(entries), name
+            )
+        )
+        for entry in entries:
+            self.lines.append("    {},".format(entry))
+        self.lines.append("}};")
+        return name
+
+    def state_machine(self, index, config_file, content_hash, data):
+        prefix = "sm{}".format(index)
+
+        services = []
+        for objects_index, (intf, object_paths) in enumerate(
+            data["ServicesToBeMonitored"].items()
+        ):
+            paths = self.array(
+                "{}_objects{}".format(prefix, objects_index),
+                "std::string_view",
+                [literal(path) for path in object_paths],
+            )
+            services.append("{{{}, {}}}".format(literal(intf), paths))
+        services = self.array(
+            prefix + "_services", "BuiltinObjects", services
+        )
+
+        states = []
+        for state_index, (name, state) in enumerate(
+            data["State"]["States"].items()
+        ):
+            conditions = []
+            for intf, condition in state["Conditions"].items():
+                logic = condition.get("Logic", "")
+                count = (
+                    int(condition["Count"])
+                    if logic in ("AtLeast", "AtMost")
+                    else 0
+                )
+                conditions.append(
+                    "{{{}, {}, {}, {}, {}, {}}}".format(
+                        literal(intf),
+                        literal(condition["Property"]),
+                        literal(value_text(condition["Value"])),
+                        literal(logic),
+                        count,
+                        int(condition.get("HoldTime", 0)),
+                    )
+                )
+            conditions = self.array(
+                "{}_conditions{}".format(prefix, state_index),
+                "BuiltinCondition",
+                conditions,
+            )
+            states.append(
+                "{{{}, {}, {}, {}}}".format(
+                    literal(name),
+                    literal(state.get("Logic", "")),
+                    int(state.get("HoldTime", 0)),
+                    conditions,
+                )
+            )
+        states = self.array(prefix + "_states", "BuiltinState", states)
+
+        placeholder = ""
+        object_name = ""
+        instances = []
+        if "Instances" in data:
+            placeholder = data["Instances"]["Placeholder"]
+            object_name = data["Instances"]["ObjectName"]
+            if "List" in data["Instances"]:
+                instances = data["Instances"]["List"]
+            else:
+                first, last = data["Instances"]["Range"]
+                instances = [str(number) for number in range(first, last + 1)]
+            # as the json runtime path checks them, TypeInCategory is the
+            # same enum value for all the instances
+            if not placeholder or placeholder not in object_name:
+                raise ValueError(
+                    "Instances need their placeholder in ObjectName"
+                )
+            object_names = [
+                object_name.replace(placeholder, instance)
+                for instance in instances
+            ]
+            for name in object_names:
+                if not re.fullmatch("[A-Za-z0-9_]+", name):
+                    raise ValueError("Invalid object name " + name)
+            if len(set(object_names)) != len(object_names):
+                raise ValueError("Instances repeat")
+            if placeholder in json.dumps(data["State"]["States"]):
+                raise ValueError(
+                    "Instances share their States, which can not use the "
+                    "placeholder"
+                )
+        instances = self.array(
+            prefix + "_instances",
+            "std::string_view",
+            [literal(instance) for instance in instances],
+        )
+
+        staleness = data.get("StalenessBudget")
+        fields = [
+            literal(config_file),
+            hex(content_hash),
+            literal(data["InterfaceName"]),
+            literal(data["TypeInCategory"]),
+            literal(data["State"]["State_property"]),
+            literal(data["State"]["Default"]),
+            int(data.get("Debounce", 0)),
+            "std::nullopt" if staleness is None else int(staleness),
+            literal(placeholder),
+            literal(object_name),
+            instances,
+            services,
+            states,
+        ]
+        return "{{{}}}".format(", ".join(str(field) for field in fields))
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(
+            "usage: {} <json dir> <output> <depfile>".format(sys.argv[0])
+        )
+    directory, output, depfile = sys.argv[1:]
+
+    # same order as the json files are loaded at runtime
+    config_files = sorted(
+        name
+        for name in os.listdir(directory)
+        if name.endswith(".json")
+        and os.path.isfile(os.path.join(directory, name))
+    )
+
+    generator = Generator()
+    state_machines = []
+    for index, config_file in enumerate(config_files):
+        path = os.path.join(directory, config_file)
+        try:
+            with open(path, "rb") as f:
+                content = f.read()
+            data = json.loads(content)
+            state_machines.append(
+                generator.state_machine(
+                    index, config_file, fnv1a(content), data
+                )
+            )
+        except (OSError, ValueError, KeyError, TypeError) as e:
+            sys.exit("{}: {!r}".format(path, e))
+    generator.array(
+        "builtinStateMachineTables", "BuiltinStateMachine", state_machines
+    )
+
+    with open(output, "w") as f:
+        f.write(
+            "// Generated by configurable_state_manager_tables.py from {},\n"
+            "// do not edit\n"
+            "#pragma once\n"
+            "\n"
+            '#include "configurable_state_manager_builtin.hpp"\n'
+            "\n"
+            "#include <array>\n"
+            "\n"
+            "namespace configurable_state_manager\n"
+            "{{\n"
+            "\n"
+            "namespace builtin\n"
+            "{{\n"
+            "\n"
+            "{}\n"
+            "\n"
+            "}} // namespace builtin\n"
+            "\n"
+            "inline constexpr std::span<const BuiltinStateMachine>\n"
+            "    builtinStateMachines{{builtin::builtinStateMachineTables}};\n"
+            "\n"
+            "}} // namespace configurable_state_manager\n".format(
+                directory, "\n".join(generator.lines)
+            )
+        )
+
+    # regenerated when a json changes, or one is added or removed
+    with open(depfile, "w") as f:
+        dependencies = [directory] + [
+            os.path.join(directory, name) for name in config_files
+        ]
+        f.write(
+            "{}: {}\n".format(
+                output,
+                " ".join(path.replace(" ", "\\ ") for path in dependencies),
+            )
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,635 @@
+#include <configurable_state_manager_rules.hpp>
+
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+using namespace configurable_state_manager;
+
+namespace
+{
+
+const std::string chassisIntf = "xyz.openbmc_project.State.Chassis";
+const std::string serviceIntf = "xyz.openbmc_project.State.ServiceReady";
+const std::string chassisPath =
+    "/xyz/openbmc_project/state/configurableStateManager/ChassisPower";
+const std::string gpuMgrPath = "/xyz/openbmc_project/GpuMgr";
+const std::string metricsPath =
+    "/xyz/openbmc_project/inventory/metrics/platformmetrics";
+
+// the TelemetryReady example of the documentation
+std::vector<State> telemetryStates()
+{
+    return {
+        {"StandbyOffline",
+         {{chassisIntf, "CurrentPowerState", "Off", ""}},
+         ""},
+        {"Enabled",
+         {{chassisIntf, "CurrentPowerState", "On", ""},
+          {serviceIntf, "State", "Enabled", "AND"}},
+         "AND"},
+        {"Starting",
+         {{chassisIntf, "CurrentPowerState", "On", ""},
+          {serviceIntf, "State", "Starting", "OR"}},
+         "AND"},
+    };
+}
+
+std::unordered_map<std::string, std::vector<std::string>> telemetryServices()
+{
+    return {{chassisIntf, {chassisPath}},
+            {serviceIntf, {gpuMgrPath, metricsPath}}};
+}
+
+void setValue(RuleProgram& program, const std::string& path,
+              const std::string& intf, const std::string& property,
+              const PropertyValue& value)
+{
+    auto slot = program.findSlot(path, intf, property);
+    ASSERT_TRUE(slot);
+    program.setValue(*slot, value);
+}
+
+} // namespace
+
+TEST(ConfigurableStateManagerRules, ExpectedValueMatchesByType)
+{
+    EXPECT_TRUE(ExpectedValue("true").matches(true));
+    EXPECT_FALSE(ExpectedValue("true").matches(false));
+    EXPECT_FALSE(ExpectedValue("1").matches(true));
+    EXPECT_TRUE(ExpectedValue("42").matches(42));
+    EXPECT_TRUE(ExpectedValue("-3").matches(-3));
+    EXPECT_FALSE(ExpectedValue("042").matches(42));
+    EXPECT_TRUE(ExpectedValue("On").matches(std::string("On")));
+    EXPECT_FALSE(ExpectedValue("On").matches(std::string("Off")));
+    EXPECT_TRUE(ExpectedValue("true").matches(std::string("true")));
+}
+
+TEST(ConfigurableStateManagerRules, UnsupportedLogicIsRejected)
+{
+    EXPECT_EQ(parseLogicOp(""), LogicOp::Single);
+    EXPECT_EQ(parseLogicOp("AND"), LogicOp::And);
+    EXPECT_EQ(parseLogicOp("OR"), LogicOp::Or);
+    EXPECT_THROW(parseLogicOp("XOR"), std::invalid_argument);
+
+    std::vector<State> states{
+        {"Enabled", {{chassisIntf, "CurrentPowerState", "On", "NAND"}}, ""}};
+    EXPECT_THROW(RuleSet{states}, std::invalid_argument);
+}
+
+TEST(ConfigurableStateManagerRules, CountBasedLogic)
+{
+    const std::string deviceIntf = "xyz.openbmc_project.State.DeviceReady";
+    const std::string psuIntf = "xyz.openbmc_project.State.Decorator.Health";
+    std::unordered_map<std::string, std::vector<std::string>> services;
+    for (int gpu = 0; gpu < 8; ++gpu)
+    {
+        services[deviceIntf].push_back("/xyz/openbmc_project/GPU_" +
+                                       std::to_string(gpu));
+    }
+    services[psuIntf] = {"/xyz/openbmc_project/PSU_0",
+                         "/xyz/openbmc_project/PSU_1",
+                         "/xyz/openbmc_project/PSU_2"};
+
+    Condition gpusReady{deviceIntf, "State", "Enabled", "AtLeast"};
+    gpusReady.count = 6;
+    Condition psusFaulted{psuIntf, "Health", "Critical", "AtMost"};
+    psusFaulted.count = 1;
+    RuleProgram program(
+        std::make_shared<RuleSet>(std::vector<State>{
+            {"Enabled", {gpusReady, psusFaulted}, "AND"}}),
+        services);
+
+    for (const std::string& gpu : services[deviceIntf])
+    {
+        setValue(program, gpu, deviceIntf, "State", std::string("Starting"));
+    }
+    for (const std::string& psu : services[psuIntf])
+    {
+        setValue(program, psu, psuIntf, "Health", std::string("OK"));
+    }
+    ASSERT_TRUE(program.complete());
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+
+    for (int gpu = 0; gpu < 6; ++gpu)
+    {
+        setValue(program, services[deviceIntf][gpu], deviceIntf, "State",
+                 std::string("Enabled"));
+    }
+    EXPECT_EQ(program.evaluate(), 0);
+
+    setValue(program, "/xyz/openbmc_project/PSU_1", psuIntf, "Health",
+             std::string("Critical"));
+    EXPECT_EQ(program.evaluate(), 0);
+    setValue(program, "/xyz/openbmc_project/PSU_2", psuIntf, "Health",
+             std::string("Critical"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    setValue(program, "/xyz/openbmc_project/PSU_2", psuIntf, "Health",
+             std::string("OK"));
+    EXPECT_EQ(program.evaluate(), 0);
+
+    // an unknown value no longer counts
+    auto slot = program.findSlot(services[deviceIntf][0], deviceIntf, "State");
+    ASSERT_TRUE(slot);
+    program.clearValue(*slot);
+    program.setValue(*slot, std::string("Starting"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+
+    // count based gates only combine objects
+    EXPECT_THROW(
+        RuleSet(std::vector<State>{{"Enabled", {gpusReady}, "AtLeast"}}),
+        std::invalid_argument);
+}
+
+TEST(ConfigurableStateManagerRules, HoldTimes)
+{
+    using namespace std::chrono_literals;
+    auto states = telemetryStates();
+    // Enabled once the services stayed Enabled for 5 s, Starting once the
+    // whole state held for 1 s
+    states[1].conditions[1].holdTime = 5s;
+    states[2].holdTime = 1s;
+    RuleProgram program(std::make_shared<RuleSet>(states),
+                        telemetryServices());
+    const uint32_t enabledHold = 2;
+    // after the 5 conditions
+    const uint32_t startingHold = 5 + 2;
+    EXPECT_EQ(program.holdCount(), 8);
+    EXPECT_EQ(program.holdTime(enabledHold), 5s);
+    EXPECT_EQ(program.holdTime(startingHold), 1s);
+    EXPECT_EQ(program.holdTime(0), 0s);
+
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Starting"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_EQ(program.holdsStarted(), std::vector<uint32_t>{startingHold});
+
+    program.holdElapsed(startingHold);
+    EXPECT_EQ(program.evaluate(), 2);
+    EXPECT_TRUE(program.holdsStarted().empty());
+
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_EQ(program.holdsStarted(), std::vector<uint32_t>{enabledHold});
+    EXPECT_EQ(program.holdsStopped(), std::vector<uint32_t>{startingHold});
+
+    // a hold which ran out after its result changed does not count
+    program.holdElapsed(startingHold);
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+
+    program.holdElapsed(enabledHold);
+    EXPECT_EQ(program.evaluate(), 1);
+
+    // and starts over on the next change
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Failed"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_EQ(program.holdsStopped(), std::vector<uint32_t>{enabledHold});
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_EQ(program.holdsStarted(), std::vector<uint32_t>{enabledHold});
+}
+
+TEST(ConfigurableStateManagerRules, DuplicatedObjectCountsOnce)
+{
+    const std::string deviceIntf = "xyz.openbmc_project.State.DeviceReady";
+    Condition devicesReady{deviceIntf, "State", "Enabled", "AtLeast"};
+    devicesReady.count = 2;
+    RuleProgram program(std::make_shared<RuleSet>(std::vector<State>{
+                            {"Enabled", {devicesReady}, "AND"}}),
+                        {{deviceIntf, {"/a", "/a", "/b"}}});
+    EXPECT_EQ(program.slotCount(), 2);
+
+    // /a listed twice is still a single object
+    setValue(program, "/a", deviceIntf, "State", std::string("Enabled"));
+    setValue(program, "/b", deviceIntf, "State", std::string("Starting"));
+    ASSERT_TRUE(program.complete());
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+
+    setValue(program, "/b", deviceIntf, "State", std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), 0);
+}
+
+TEST(ConfigurableStateManagerRules, SlotsAreSharedBetweenConditions)
+{
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        telemetryServices());
+
+    // CurrentPowerState of ChassisPower is used by all three states
+    EXPECT_EQ(program.slotCount(), 3);
+    EXPECT_TRUE(program.findSlot(chassisPath, chassisIntf, "CurrentPowerState"));
+    EXPECT_FALSE(program.findSlot(chassisPath, chassisIntf, "Unused"));
+    EXPECT_FALSE(program.complete());
+}
+
+TEST(ConfigurableStateManagerRules, FirstMatchingStateWins)
+{
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        telemetryServices());
+
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("Off"));
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Starting"));
+    ASSERT_TRUE(program.complete());
+    EXPECT_EQ(program.evaluate(), 0);
+
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    // only one of the services is Enabled, but one is Starting
+    EXPECT_EQ(program.evaluate(), 2);
+
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), 1);
+
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Failed"));
+    setValue(program, metricsPath, serviceIntf, "State", std::string("Failed"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+}
+
+TEST(ConfigurableStateManagerRules, RemovedInterfaceIsForgotten)
+{
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        telemetryServices());
+
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), 1);
+
+    // the service left the bus, its last value must not keep Enabled
+    EXPECT_TRUE(program.clearValues(metricsPath, serviceIntf));
+    EXPECT_FALSE(program.clearValues(metricsPath, serviceIntf));
+    EXPECT_FALSE(program.clearValues(metricsPath, chassisIntf));
+    EXPECT_FALSE(program.complete());
+    EXPECT_FALSE(program.hasValue(
+        *program.findSlot(metricsPath, serviceIntf, "State")));
+    EXPECT_TRUE(program.hasValue(
+        *program.findSlot(gpuMgrPath, serviceIntf, "State")));
+
+    // back with another value, no state holds any more
+    setValue(program, metricsPath, serviceIntf, "State", std::string("Failed"));
+    ASSERT_TRUE(program.complete());
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+}
+
+TEST(ConfigurableStateManagerRules, MissingValuesOnlyHoldUpTheirStates)
+{
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        telemetryServices());
+
+    // the services are still being fetched, StandbyOffline does not need
+    // them
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("Off"));
+    EXPECT_EQ(program.evaluate(), 0);
+    EXPECT_TRUE(program.decided());
+
+    // neither state needs them with the power state known to be neither
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("Unknown"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_TRUE(program.decided());
+
+    // Enabled does, it waits for all of them
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_FALSE(program.decided());
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_FALSE(program.decided());
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Starting"));
+    EXPECT_EQ(program.evaluate(), 2);
+    EXPECT_TRUE(program.decided());
+
+    // a value fetched again holds them up again
+    program.clearValues(gpuMgrPath, serviceIntf);
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+    EXPECT_FALSE(program.decided());
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    EXPECT_EQ(program.evaluate(), 2);
+    EXPECT_TRUE(program.decided());
+}
+
+TEST(ConfigurableStateManagerRules, OnlyAffectedConditionsAreRechecked)
+{
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        telemetryServices());
+
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    setValue(program, gpuMgrPath, serviceIntf, "State", std::string("Enabled"));
+    setValue(program, metricsPath, serviceIntf, "State",
+             std::string("Starting"));
+    EXPECT_EQ(program.evaluate(), 2);
+    // every condition is checked on the first evaluation
+    EXPECT_EQ(program.conditionEvaluations(), 5);
+
+    // nothing changed, nothing to check
+    EXPECT_EQ(program.evaluate(), 2);
+    EXPECT_EQ(program.conditionEvaluations(), 5);
+
+    // same value again is not a change
+    auto slot = program.findSlot(gpuMgrPath, serviceIntf, "State");
+    ASSERT_TRUE(slot);
+    EXPECT_FALSE(program.setValue(*slot, std::string("Enabled")));
+
+    // the State of MetricsPath is used by one condition of Enabled and one
+    // of Starting
+    EXPECT_TRUE(program.setValue(
+        *program.findSlot(metricsPath, serviceIntf, "State"),
+        std::string("Enabled")));
+    EXPECT_EQ(program.evaluate(), 1);
+    EXPECT_EQ(program.conditionEvaluations(), 7);
+
+    // the power state is used by a condition of every state
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("Off"));
+    EXPECT_EQ(program.evaluate(), 0);
+    EXPECT_EQ(program.conditionEvaluations(), 10);
+}
+
+TEST(ConfigurableStateManagerRules, PathNamespace)
+{
+    EXPECT_EQ(pathNamespace(chassisPath, 3), "/xyz/openbmc_project/state");
+    EXPECT_EQ(pathNamespace(gpuMgrPath, 3), gpuMgrPath);
+    EXPECT_EQ(pathNamespace(gpuMgrPath, 2), "/xyz/openbmc_project");
+
+    EXPECT_TRUE(inPathNamespace(chassisPath, "/xyz/openbmc_project/state"));
+    EXPECT_TRUE(inPathNamespace(gpuMgrPath, gpuMgrPath));
+    EXPECT_TRUE(inPathNamespace(gpuMgrPath, "/"));
+    EXPECT_FALSE(inPathNamespace("/xyz/openbmc_project/GpuMgrs", gpuMgrPath));
+    EXPECT_FALSE(inPathNamespace("/xyz", gpuMgrPath));
+}
+
+TEST(ConfigurableStateManagerRules, PathPatterns)
+{
+    const std::string gpus = "/xyz/openbmc_project/inventory/system/GPU_*";
+    EXPECT_TRUE(isPathPattern(gpus));
+    EXPECT_FALSE(isPathPattern(gpuMgrPath));
+
+    EXPECT_TRUE(
+        matchPathPattern(gpus, "/xyz/openbmc_project/inventory/system/GPU_0"));
+    EXPECT_TRUE(
+        matchPathPattern(gpus, "/xyz/openbmc_project/inventory/system/GPU_"));
+    EXPECT_FALSE(matchPathPattern(
+        gpus, "/xyz/openbmc_project/inventory/system/GPU_0/Port_1"));
+    EXPECT_FALSE(
+        matchPathPattern(gpus, "/xyz/openbmc_project/inventory/system/CPU_0"));
+    EXPECT_TRUE(matchPathPattern("/xyz/*/system/*_0/Port_*",
+                                 "/xyz/openbmc_project/system/GPU_0/Port_12"));
+    EXPECT_TRUE(matchPathPattern("/xyz/openbmc_project/**/Port_*",
+                                 "/xyz/openbmc_project/system/GPU_0/Port_1"));
+    EXPECT_TRUE(matchPathPattern("/xyz/openbmc_project/**",
+                                 "/xyz/openbmc_project"));
+    EXPECT_FALSE(matchPathPattern("/xyz/openbmc_project/**/Port_*",
+                                  "/xyz/openbmc_project/system/GPU_0"));
+
+    EXPECT_EQ(patternRoot(gpus), "/xyz/openbmc_project/inventory/system");
+    EXPECT_EQ(patternRoot("/xyz/openbmc_project/**/Port_*"),
+              "/xyz/openbmc_project");
+    EXPECT_EQ(patternRoot("/*"), "/");
+
+    auto services = telemetryServices();
+    services[serviceIntf].push_back(gpus);
+    EXPECT_EQ(explicitObjects(services), telemetryServices());
+
+    // AND over a pattern which matches no object does not hold
+    services[serviceIntf] = {gpus};
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        explicitObjects(services));
+    setValue(program, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    ASSERT_TRUE(program.complete());
+    EXPECT_EQ(program.evaluate(), std::nullopt);
+}
+
+TEST(ConfigurableStateManagerRules, UnitObjectPath)
+{
+    EXPECT_EQ(unitObjectPath("nvidia-gpu-manager.service"),
+              "/org/freedesktop/systemd1/unit/nvidia_2dgpu_2dmanager_2eservice");
+    EXPECT_EQ(unitObjectPath("obmc-chassis-poweron@0.target"),
+              "/org/freedesktop/systemd1/unit/"
+              "obmc_2dchassis_2dpoweron_400_2etarget");
+    EXPECT_EQ(unitObjectPath("1st_unit"),
+              "/org/freedesktop/systemd1/unit/_31st_5funit");
+    EXPECT_EQ(unitObjectPath(""), "/org/freedesktop/systemd1/unit/_");
+}
+
+TEST(ConfigurableStateManagerRules, ValuesAreAdoptedOnReload)
+{
+    RuleProgram previous(std::make_shared<RuleSet>(telemetryStates()),
+                         telemetryServices());
+    setValue(previous, chassisPath, chassisIntf, "CurrentPowerState",
+             std::string("On"));
+    setValue(previous, gpuMgrPath, serviceIntf, "State",
+             std::string("Enabled"));
+
+    // GpuMgr is no longer monitored, a new object is
+    const std::string fpgaPath = "/xyz/openbmc_project/FpgaReady";
+    auto services = telemetryServices();
+    services[serviceIntf] = {metricsPath, fpgaPath};
+    RuleProgram program(std::make_shared<RuleSet>(telemetryStates()),
+                        services);
+    program.adoptValues(previous);
+
+    auto chassis = program.findSlot(chassisPath, chassisIntf,
+                                    "CurrentPowerState");
+    ASSERT_TRUE(chassis);
+    EXPECT_TRUE(program.hasValue(*chassis));
+    EXPECT_EQ(program.value(*chassis), PropertyValue(std::string("On")));
+    EXPECT_FALSE(program.hasValue(*program.findSlot(metricsPath, serviceIntf,
+                                                    "State")));
+    EXPECT_FALSE(program.findSlot(gpuMgrPath, serviceIntf, "State"));
+    EXPECT_FALSE(program.complete());
+}
+
+TEST(ConfigurableStateManagerRules, InstancesShareRules)
+{
+    EXPECT_EQ(expandPlaceholder("/xyz/GPU_{N}/Port_{N}", "{N}", "3"),
+              "/xyz/GPU_3/Port_3");
+    EXPECT_EQ(expandPlaceholder("/xyz/GPU_0", "{N}", "3"), "/xyz/GPU_0");
+    EXPECT_EQ(expandPlaceholder("/xyz/GPU_{N}", "", "3"), "/xyz/GPU_{N}");
+
+    auto rules = std::make_shared<const RuleSet>(telemetryStates());
+    std::vector<RuleProgram> instances;
+    for (const std::string instance : {"0", "1"})
+    {
+        std::unordered_map<std::string, std::vector<std::string>> services;
+        for (const auto& [intf, objectPaths] : telemetryServices())
+        {
+            for (const std::string& objectPath : objectPaths)
+            {
+                services[intf].push_back(
+                    expandPlaceholder(objectPath + "_{N}", "{N}", instance));
+            }
+        }
+        instances.emplace_back(rules, services);
+    }
+    EXPECT_EQ(instances[0].sharedRuleSet(), instances[1].sharedRuleSet());
+
+    setValue(instances[0], chassisPath + "_0", chassisIntf,
+             "CurrentPowerState", std::string("Off"));
+    EXPECT_FALSE(instances[1].findSlot(chassisPath + "_0", chassisIntf,
+                                       "CurrentPowerState"));
+    setValue(instances[1], chassisPath + "_1", chassisIntf,
+             "CurrentPowerState", std::string("On"));
+    for (RuleProgram& program : instances)
+    {
+        for (size_t slot = 0; slot < program.slotCount(); ++slot)
+        {
+            if (!program.hasValue(slot))
+            {
+                program.setValue(slot, std::string("Enabled"));
+            }
+        }
+    }
+    EXPECT_EQ(instances[0].evaluate(), 0U);
+    EXPECT_EQ(instances[1].evaluate(), 1U);
+}
+
+TEST(ConfigurableStateManagerRules, InstancesAreExpanded)
+{
+    RuleSet rules(telemetryStates());
+    std::unordered_map<std::string, std::vector<std::string>> services{
+        {chassisIntf, {chassisPath + "_{N}"}},
+        {serviceIntf, {gpuMgrPath + "/GPU_{N}", metricsPath}}};
+
+    std::vector<Instance> instances =
+        expandInstances("{N}", "Telemetry_GPU{N}", {"0", "1"}, services, rules);
+    ASSERT_EQ(instances.size(), 2U);
+    EXPECT_EQ(instances[0].objectName, "Telemetry_GPU0");
+    EXPECT_EQ(instances[1].objectName, "Telemetry_GPU1");
+    EXPECT_EQ(instances[1].servicesToBeMonitored.at(chassisIntf),
+              std::vector<std::string>{chassisPath + "_1"});
+    EXPECT_EQ(instances[1].servicesToBeMonitored.at(serviceIntf),
+              (std::vector<std::string>{gpuMgrPath + "/GPU_1", metricsPath}));
+
+    // each instance only follows its own objects
+    auto shared = std::make_shared<const RuleSet>(telemetryStates());
+    std::vector<RuleProgram> programs;
+    for (const Instance& instance : instances)
+    {
+        programs.emplace_back(shared, instance.servicesToBeMonitored);
+    }
+    setValue(programs[1], chassisPath + "_1", chassisIntf,
+             "CurrentPowerState", std::string("On"));
+    for (RuleProgram& program : programs)
+    {
+        EXPECT_FALSE(program.findSlot(chassisPath + "_{N}", chassisIntf,
+                                      "CurrentPowerState"));
+        for (size_t slot = 0; slot < program.slotCount(); ++slot)
+        {
+            if (!program.hasValue(slot))
+            {
+                program.setValue(slot, std::string("Off"));
+            }
+        }
+    }
+    setValue(programs[1], gpuMgrPath + "/GPU_1", serviceIntf, "State",
+             std::string("Enabled"));
+    setValue(programs[1], metricsPath, serviceIntf, "State",
+             std::string("Enabled"));
+    EXPECT_EQ(programs[0].evaluate(), 0U);
+    EXPECT_EQ(programs[1].evaluate(), 1U);
+
+    // the instances would not get an object each
+    EXPECT_THROW(expandInstances("{N}", "Telemetry", {"0"}, services, rules),
+                 std::invalid_argument);
+    EXPECT_THROW(
+        expandInstances("{N}", "GPU{N}", {"0", "0"}, services, rules),
+        std::invalid_argument);
+    EXPECT_THROW(expandInstances("{N}", "GPU{N}", {"0/1"}, services, rules),
+                 std::invalid_argument);
+    EXPECT_THROW(expandInstances("", "GPU{N}", {"0"}, services, rules),
+                 std::invalid_argument);
+    // nor share their states
+    EXPECT_THROW(
+        expandInstances("Enabled", "GPUEnabled", {"0"}, services, rules),
+        std::invalid_argument);
+}
+
+TEST(ConfigurableStateManagerRules, Fnv1a)
+{
+    EXPECT_EQ(fnv1a(""), fnv1aOffsetBasis);
+    EXPECT_EQ(fnv1a("a"), 0xaf63dc4c8601ec8cU);
+    EXPECT_EQ(fnv1a("foobar"), 0x85944171f73967e8U);
+    EXPECT_EQ(fnv1a("bar", fnv1a("foo")), fnv1a("foobar"));
+}
+
+TEST(ConfigurableStateManagerRules, LatencyHistogram)
+{
+    using namespace std::chrono_literals;
+    EvaluationMetrics metrics;
+    metrics.recordLatency(500ns);
+    metrics.recordLatency(1us);
+    metrics.recordLatency(3us);
+    metrics.recordLatency(1023us);
+    metrics.recordLatency(1024us);
+    metrics.recordLatency(1s);
+    metrics.recordLatency(10s);
+    metrics.recordLatency(1h);
+
+    std::array<uint64_t, EvaluationMetrics::latencyBuckets> expected{};
+    expected[0] = 1;
+    expected[1] = 1;
+    expected[2] = 1;
+    expected[10] = 1;
+    expected[11] = 1;
+    expected[20] = 1;
+    expected[23] = 2;
+    EXPECT_EQ(metrics.latencyHistogram, expected);
+    EXPECT_EQ(EvaluationMetrics::latencyBucketBound(2), 4U);
+}
+
+TEST(ConfigurableStateManagerRules, TransitionHistory)
+{
+    TransitionHistory history(3);
+    EXPECT_TRUE(history.records().empty());
+    for (uint64_t timestamp = 1; timestamp <= 5; ++timestamp)
+    {
+        history.record({timestamp, "Off", "On", chassisPath});
+        if (timestamp == 2)
+        {
+            auto records = history.records();
+            ASSERT_EQ(records.size(), 2U);
+            EXPECT_EQ(records.front().timestamp, 1U);
+        }
+    }
+
+    // the oldest ones are overwritten
+    auto records = history.records();
+    ASSERT_EQ(records.size(), 3U);
+    EXPECT_EQ(records[0].timestamp, 3U);
+    EXPECT_EQ(records[1].timestamp, 4U);
+    EXPECT_EQ(records[2].timestamp, 5U);
+    EXPECT_EQ(records[2].trigger, chassisPath);
+    EXPECT_EQ(history.capacity(), 3U);
+
+    TransitionHistory disabled(0);
+    disabled.record({1, "Off", "On", chassisPath});
+    EXPECT_TRUE(disabled.records().empty());
+}
+
+TEST(ConfigurableStateManagerRules, DependencyOrder)
+{
+    // 0: Telemetry on 2, 1: Device on 2, 2: ChassisPower, 3: Feature on 0, 1
+    auto result = orderDependencies({{2}, {2}, {}, {0, 1}});
+    EXPECT_EQ(result.order, (std::vector<size_t>{2, 0, 1, 3}));
+    EXPECT_TRUE(result.cycles.empty());
+
+    // 1 and 2 depend on each other, 3 on itself, 0 on the loop
+    result = orderDependencies({{1}, {2}, {1}, {3}, {}});
+    EXPECT_EQ(result.order, (std::vector<size_t>{0, 4}));
+    EXPECT_EQ(result.cycles,
+              (std::vector<std::vector<size_t>>{{1, 2}, {3}}));
+}
@@ -0,0 +1,132 @@
+#include <utils.hpp>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+using phosphor::state::manager::utils::ServiceCache;
+
+namespace
+{
+
+const std::string chassisIntf = "xyz.openbmc_project.State.Chassis";
+const std::string hostIntf = "xyz.openbmc_project.State.Host";
+const std::string chassisPath = "/xyz/openbmc_project/state/chassis0";
+
+std::string objectPath(size_t index)
+{
+    return "/xyz/openbmc_project/inventory/object" + std::to_string(index);
+}
+
+} // namespace
+
+TEST(ServiceCache, HitsAndMisses)
+{
+    ServiceCache cache;
+    // only consulted by getService() once watch() was called
+    EXPECT_FALSE(cache.enabled());
+
+    EXPECT_EQ(cache.find(chassisPath, chassisIntf), std::nullopt);
+    cache.insert(chassisPath, chassisIntf, "xyz.openbmc_project.State.Chassis");
+    EXPECT_EQ(cache.find(chassisPath, chassisIntf),
+              "xyz.openbmc_project.State.Chassis");
+    EXPECT_EQ(cache.find(chassisPath, hostIntf), std::nullopt);
+    EXPECT_EQ(cache.hits(), 1U);
+    EXPECT_EQ(cache.misses(), 2U);
+    EXPECT_EQ(cache.size(), 1U);
+
+    // a new owner replaces the entry
+    cache.insert(chassisPath, chassisIntf, "xyz.openbmc_project.Chassis1");
+    EXPECT_EQ(cache.find(chassisPath, chassisIntf),
+              "xyz.openbmc_project.Chassis1");
+    EXPECT_EQ(cache.size(), 1U);
+}
+
+TEST(ServiceCache, LeastRecentlyUsedIsDropped)
+{
+    ServiceCache cache;
+    ASSERT_EQ(cache.capacity(), ServiceCache::defaultCapacity);
+    for (size_t index = 0; index < cache.capacity(); ++index)
+    {
+        cache.insert(objectPath(index), chassisIntf, "service");
+    }
+    EXPECT_EQ(cache.size(), cache.capacity());
+
+    // the first object was used last, the second one goes
+    EXPECT_TRUE(cache.find(objectPath(0), chassisIntf));
+    cache.insert(objectPath(cache.capacity()), chassisIntf, "service");
+    EXPECT_EQ(cache.size(), cache.capacity());
+    EXPECT_TRUE(cache.find(objectPath(0), chassisIntf));
+    EXPECT_FALSE(cache.find(objectPath(1), chassisIntf));
+    EXPECT_TRUE(cache.find(objectPath(2), chassisIntf));
+    EXPECT_TRUE(cache.find(objectPath(cache.capacity()), chassisIntf));
+}
+
+TEST(ServiceCache, ReserveGrowsTheCapacity)
+{
+    ServiceCache cache;
+    size_t objects = 2 * ServiceCache::defaultCapacity;
+    cache.reserve(objects);
+    EXPECT_EQ(cache.capacity(), objects);
+    // never shrinks
+    cache.reserve(1);
+    EXPECT_EQ(cache.capacity(), objects);
+
+    for (size_t index = 0; index < objects; ++index)
+    {
+        cache.insert(objectPath(index), chassisIntf, "service");
+    }
+    for (size_t index = 0; index < objects; ++index)
+    {
+        EXPECT_TRUE(cache.find(objectPath(index), chassisIntf));
+    }
+    EXPECT_EQ(cache.misses(), 0U);
+}
+
+TEST(ServiceCache, Invalidation)
+{
+    ServiceCache cache;
+    cache.insert(chassisPath, chassisIntf, "chassis.service");
+    cache.insert(chassisPath, hostIntf, "host.service");
+    cache.insert(chassisPath + "/sub", chassisIntf, "chassis.service");
+    cache.insert(objectPath(0), hostIntf, "host.service");
+
+    // every interface of the path, not the objects below it
+    cache.invalidatePath(chassisPath);
+    EXPECT_FALSE(cache.find(chassisPath, chassisIntf));
+    EXPECT_FALSE(cache.find(chassisPath, hostIntf));
+    EXPECT_TRUE(cache.find(chassisPath + "/sub", chassisIntf));
+    EXPECT_EQ(cache.size(), 2U);
+
+    cache.invalidateService("host.service");
+    EXPECT_FALSE(cache.find(objectPath(0), hostIntf));
+    EXPECT_TRUE(cache.find(chassisPath + "/sub", chassisIntf));
+    EXPECT_EQ(cache.size(), 1U);
+
+    // the dropped entries can come back
+    cache.insert(objectPath(0), hostIntf, "host.service");
+    EXPECT_EQ(cache.find(objectPath(0), hostIntf), "host.service");
+}
+
+TEST(ServiceCache, ServiceIndexFollowsTheEntries)
+{
+    ServiceCache cache;
+    cache.insert(chassisPath, chassisIntf, "old.service");
+    // the object moved, the old service going away does not drop it
+    cache.insert(chassisPath, chassisIntf, "new.service");
+    cache.invalidateService("old.service");
+    EXPECT_EQ(cache.find(chassisPath, chassisIntf), "new.service");
+
+    // an evicted entry is gone from its service as well
+    for (size_t index = 0; index < cache.capacity(); ++index)
+    {
+        cache.insert(objectPath(index), hostIntf, "host.service");
+    }
+    EXPECT_FALSE(cache.find(chassisPath, chassisIntf));
+    cache.invalidateService("new.service");
+    EXPECT_EQ(cache.size(), cache.capacity());
+
+    cache.invalidateService("host.service");
+    EXPECT_EQ(cache.size(), 0U);
+    cache.invalidateService("unknown.service");
+}
@@ -10,6 +10,7 @@
 #include <xyz/openbmc_project/ObjectMapper/client.hpp>
 #include <xyz/openbmc_project/State/BMC/client.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <format>
@@ -38,7 +39,6 @@ PropertyValue getPropertyV2(sdbusplus::bus::bus& bus,
                             const std::string& interface,
                             const std::string& propertyName)
 {
-    static auto newBus = sdbusplus::bus::new_default();
     PropertyValue value{};
 
     auto service = getService(bus, objectPath, interface);
@@ -48,10 +48,10 @@ PropertyValue getPropertyV2(sdbusplus::bus::bus& bus,
         return value;
     }
 
-    auto method = newBus.new_method_call(service.c_str(), objectPath.c_str(),
-                                         PROPERTY_INTERFACE, "Get");
+    auto method = bus.new_method_call(service.c_str(), objectPath.c_str(),
+                                      PROPERTY_INTERFACE, "Get");
     method.append(interface, propertyName);
-    auto reply = newBus.call(method);
+    auto reply = bus.call(method);
     reply.read(value);
     return value;
 }
@@ -80,9 +80,151 @@ void subscribeToSystemdSignals(sdbusplus::bus_t& bus)
     return;
 }
 
+ServiceCache& ServiceCache::instance()
+{
+    static ServiceCache cache;
+    return cache;
+}
+
+void ServiceCache::watch(sdbusplus::bus_t& bus)
+{
+    if (enabled())
+    {
+        return;
+    }
+
+    // only names leaving the bus, i.e. without a new owner
+    ownerMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus,
+        sdbusplus::bus::match::rules::nameOwnerChanged() +
+            sdbusplus::bus::match::rules::argN(2, ""),
+        [this](sdbusplus::message_t& msg) {
+        std::string name;
+        std::string oldOwner;
+        std::string newOwner;
+        try
+        {
+            msg.read(name, oldOwner, newOwner);
+        }
+        catch (const sdbusplus::exception_t& e)
+        {
+            error("Unable to read NameOwnerChanged signal: {ERROR}", "ERROR",
+                  e);
+            return;
+        }
+        // the mapper resolves to well known names, the unique names of
+        // short lived clients are never cached
+        if (name.starts_with(':') || !newOwner.empty())
+        {
+            return;
+        }
+        invalidateService(name);
+    });
+}
+
+void ServiceCache::reserve(size_t entries)
+{
+    maxEntries = std::max(maxEntries, entries);
+}
+
+std::optional<std::string> ServiceCache::find(const std::string& path,
+                                              const std::string& interface)
+{
+    auto it = entries.find(Key{path, interface});
+    if (it == entries.end())
+    {
+        ++missCount;
+        return std::nullopt;
+    }
+
+    ++hitCount;
+    lru.splice(lru.begin(), lru, it->second.lruPos);
+    return it->second.service;
+}
+
+void ServiceCache::insert(const std::string& path, const std::string& interface,
+                          const std::string& service)
+{
+    Key key{path, interface};
+    auto it = entries.find(key);
+    if (it != entries.end())
+    {
+        if (it->second.service != service)
+        {
+            auto keys = keysByService.find(it->second.service);
+            keys->second.erase(key);
+            if (keys->second.empty())
+            {
+                keysByService.erase(keys);
+            }
+            keysByService[service].insert(key);
+            it->second.service = service;
+        }
+        lru.splice(lru.begin(), lru, it->second.lruPos);
+        return;
+    }
+
+    if (entries.size() >= maxEntries)
+    {
+        erase(entries.find(lru.back()));
+    }
+    lru.push_front(key);
+    keysByService[service].insert(key);
+    entries.emplace(std::move(key), Entry{service, lru.begin()});
+}
+
+std::map<ServiceCache::Key, ServiceCache::Entry>::iterator
+    ServiceCache::erase(std::map<Key, Entry>::iterator it)
+{
+    auto keys = keysByService.find(it->second.service);
+    keys->second.erase(it->first);
+    if (keys->second.empty())
+    {
+        keysByService.erase(keys);
+    }
+    lru.erase(it->second.lruPos);
+    return entries.erase(it);
+}
+
+void ServiceCache::invalidatePath(const std::string& path)
+{
+    auto it = entries.lower_bound(Key{path, std::string{}});
+    while (it != entries.end() && it->first.first == path)
+    {
+        it = erase(it);
+    }
+}
+
+void ServiceCache::invalidateService(const std::string& service)
+{
+    auto keys = keysByService.find(service);
+    if (keys == keysByService.end())
+    {
+        return;
+    }
+    // only the entries of the service are visited
+    std::set<Key> serviceKeys = std::move(keys->second);
+    keysByService.erase(keys);
+    for (const Key& key : serviceKeys)
+    {
+        auto it = entries.find(key);
+        lru.erase(it->second.lruPos);
+        entries.erase(it);
+    }
+}
+
 std::string getService(sdbusplus::bus_t& bus, std::string path,
                        std::string interface)
 {
+    auto& cache = ServiceCache::instance();
+    if (cache.enabled())
+    {
+        if (auto service = cache.find(path, interface))
+        {
+            return *service;
+        }
+    }
+
     auto mapper = bus.new_method_call(ObjectMapper::default_service,
                                       ObjectMapper::instance_path,
                                       ObjectMapper::interface, "GetObject");
@@ -111,6 +253,10 @@ std::string getService(sdbusplus::bus_t& bus, std::string path,
         throw;
     }
 
+    if (cache.enabled())
+    {
+        cache.insert(path, interface, mapperResponse.begin()->first);
+    }
     return mapperResponse.begin()->first;
 }
 
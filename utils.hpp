@@ -1,8 +1,16 @@
 #pragma once
 
 #include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
 #include <xyz/openbmc_project/Logging/Entry/server.hpp>
 
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
 namespace phosphor
 {
 namespace state
@@ -13,6 +21,113 @@ namespace utils
 {
 
 using PropertyValue = std::variant<int, std::string, bool>;
+
+/** @class ServiceCache
+ *  @brief Process wide (path, interface) -> service name cache used by
+ *         getService() to avoid an ObjectMapper call on every lookup
+ *
+ *  The cache is only consulted once watch() was called, so processes which
+ *  never call it behave as before. watch() only matches the well known
+ *  names leaving the bus. A process calling it must hand every
+ *  InterfacesAdded/InterfacesRemoved signal to invalidatePath() itself,
+ *  otherwise an object moved to another service keeps resolving to the old
+ *  one; csm does so from the rules it already has for these signals.
+ */
+class ServiceCache
+{
+  public:
+    /** @brief Number of (path, interface) entries kept unless reserve()
+     *         asks for more, the least recently used one is dropped when
+     *         full */
+    static constexpr size_t defaultCapacity = 256;
+
+    /** @brief Return the process wide cache */
+    static ServiceCache& instance();
+
+    /** @brief Enable the cache and drop the entries of a well known name
+     *         once it leaves the bus. The caller forwards InterfacesAdded
+     *         and InterfacesRemoved to invalidatePath().
+     *
+     * @param[in] bus          - The Dbus bus object, must outlive the cache
+     */
+    void watch(sdbusplus::bus_t& bus);
+
+    /** @brief Whether watch() was called */
+    bool enabled() const
+    {
+        return ownerMatch != nullptr;
+    }
+
+    /** @brief Keep at least entries entries, e.g. all the objects a process
+     *         monitors, so that they do not evict each other. The capacity
+     *         never shrinks. */
+    void reserve(size_t entries);
+
+    size_t capacity() const
+    {
+        return maxEntries;
+    }
+
+    /** @brief Look up the service for path and interface
+     *
+     * @return The service name or std::nullopt, counted as hit or miss
+     */
+    std::optional<std::string> find(const std::string& path,
+                                    const std::string& interface);
+
+    /** @brief Remember the service for path and interface */
+    void insert(const std::string& path, const std::string& interface,
+                const std::string& service);
+
+    /** @brief Drop every entry of the object path */
+    void invalidatePath(const std::string& path);
+
+    /** @brief Drop every entry resolved to the service */
+    void invalidateService(const std::string& service);
+
+    /** @brief Number of lookups answered from the cache */
+    uint64_t hits() const
+    {
+        return hitCount;
+    }
+
+    /** @brief Number of lookups which had to go to the mapper */
+    uint64_t misses() const
+    {
+        return missCount;
+    }
+
+    /** @brief Number of entries currently cached */
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+  private:
+    using Key = std::pair<std::string, std::string>;
+
+    struct Entry
+    {
+        std::string service;
+        std::list<Key>::iterator lruPos;
+    };
+
+    /** @brief Drop an entry from the cache and its indexes
+     *  @return the entry after it */
+    std::map<Key, Entry>::iterator erase(std::map<Key, Entry>::iterator it);
+
+    std::map<Key, Entry> entries;
+    /** @brief Keys ordered from most to least recently used */
+    std::list<Key> lru;
+    /** @brief Keys of the entries of each service, so that a service going
+     *         away does not scan the whole cache */
+    std::unordered_map<std::string, std::set<Key>> keysByService;
+    size_t maxEntries = defaultCapacity;
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+    std::unique_ptr<sdbusplus::bus::match_t> ownerMatch;
+};
+
 /** @brief Tell systemd to generate d-bus events
  *
  * @param[in] bus          - The Dbus bus object
@@ -22,6 +137,8 @@ using PropertyValue = std::variant<int, std::string, bool>;
 void subscribeToSystemdSignals(sdbusplus::bus_t& bus);
 
 /** @brief Get service name from object path and interface
+ *
+ * Answered from the ServiceCache when it is enabled for this process.
  *
  * @param[in] bus          - The Dbus bus object
  * @param[in] path         - The Dbus object path